@@ -0,0 +1,21 @@
+QT       += core gui widgets concurrent
+
+TARGET = hivebenchmark
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += hivebenchmark.cpp \
+    ../hivewidget.cpp \
+    ../hivegraph.cpp \
+    ../framestats.cpp \
+    ../toolcommon.cpp
+
+HEADERS  += \
+    ../hivewidget.h \
+    ../hivegraph.h \
+    ../framestats.h \
+    ../toolcommon.h
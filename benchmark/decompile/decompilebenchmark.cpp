@@ -0,0 +1,151 @@
+#include "replicodehandler.h"
+#include "toolcommon.h"
+#include <r_code/image.h>
+#include <r_code/image_impl.h>
+#include <r_comp/segments.h>
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QThreadPool>
+#include <QThread>
+#include <QFile>
+#include <QTextStream>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <fstream>
+
+// Has access to the internals of ReplicodeHandler, so decompiling can be timed without the GUI around it
+class DecompileBenchmark
+{
+public:
+    DecompileBenchmark(int runs) : m_runs(runs) {
+        // Decompiling needs the metadata from the classes
+        m_handler.waitForInitialized();
+    }
+
+    QJsonObject run(const QString &imageFile, int scale);
+
+private:
+    ReplicodeHandler m_handler;
+    int m_runs;
+};
+
+static bool isIdentical(const DecompiledImage &a, const DecompiledImage &b)
+{
+    if (a.sources != b.sources || a.nodes.count() != b.nodes.count() || a.edges.count() != b.edges.count()) {
+        return false;
+    }
+    for (int i=0; i<a.nodes.count(); i++) {
+        if (a.nodes[i].displayName != b.nodes[i].displayName || a.nodes[i].subgroup != b.nodes[i].subgroup || a.nodes[i].objectIndex != b.nodes[i].objectIndex) {
+            return false;
+        }
+    }
+    for (int i=0; i<a.edges.count(); i++) {
+        if (a.edges[i].source != b.edges[i].source || a.edges[i].target != b.edges[i].target || a.edges[i].isView != b.edges[i].isView) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QJsonObject DecompileBenchmark::run(const QString &imageFile, int scale)
+{
+    // Loading the same image several times gives a bigger one with the same mix of objects,
+    // the copies refer to the objects of the first one
+    r_comp::Image image;
+    for (int i=0; i<scale; i++) {
+        QString errorString;
+        r_code::Image<r_code::ImageImpl> *copy = ReplicodeHandler::readImage(imageFile, &errorString);
+        if (!copy) {
+            QTextStream(stderr) << "Unable to load " << imageFile << ": " << errorString << "\n";
+            return QJsonObject();
+        }
+        image.load(copy);
+        delete copy;
+    }
+
+    QJsonObject result;
+    result["scale"] = scale;
+
+    // What checking the raw image costs on top of reading it, the objects are created from it the same way after that
+    result["readMs"] = bestOf(m_runs, [&]() {
+        for (int i=0; i<scale; i++) {
+            std::ifstream input(imageFile.toStdString(), std::ios::binary | std::ios::in);
+            delete r_code::Image<r_code::ImageImpl>::Read(input);
+        }
+    });
+    result["checkedReadMs"] = bestOf(m_runs, [&]() {
+        QString errorString;
+        for (int i=0; i<scale; i++) {
+            delete ReplicodeHandler::readImage(imageFile, &errorString);
+        }
+    });
+    result["objects"] = qint64(image.code_segment.objects.size());
+
+    const int maxThreads = QThreadPool::globalInstance()->maxThreadCount();
+    DecompiledImage serial;
+    DecompiledImage parallel;
+
+    DecompiledImage cached;
+
+    // The cache is cleared for the cold runs, otherwise only the first one would decompile anything
+    QThreadPool::globalInstance()->setMaxThreadCount(1);
+    result["serialMs"] = bestOf(m_runs, [&]() {
+        m_handler.m_decompileCache.clear();
+        serial = m_handler.decompileImage(&image);
+    });
+    QThreadPool::globalInstance()->setMaxThreadCount(maxThreads);
+    result["parallelMs"] = bestOf(m_runs, [&]() {
+        m_handler.m_decompileCache.clear();
+        parallel = m_handler.decompileImage(&image);
+    });
+
+    // Like stopping again after nothing changed
+    result["cachedMs"] = bestOf(m_runs, [&]() { cached = m_handler.decompileImage(&image); });
+
+    result["threads"] = maxThreads;
+    result["speedup"] = result["serialMs"].toDouble() / qMax(result["parallelMs"].toDouble(), 0.001);
+    result["identical"] = isIdentical(serial, parallel) && isIdentical(serial, cached);
+    result["nodes"] = parallel.nodes.count();
+    result["edges"] = parallel.edges.count();
+
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    useOffscreenPlatform();
+    QGuiApplication application(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times decompiling an image serially, sharded across threads and from the cache, and prints the results as JSON");
+    parser.addHelpOption();
+    QCommandLineOption imageOption("image", "Image to decompile", "file", "example-all-objects.image");
+    QCommandLineOption scalesOption("scales", "Comma separated number of copies of the image to decompile at once", "counts", "1,4,16,64");
+    QCommandLineOption runsOption("runs", "Runs per measurement, the best one is reported", "runs", "3");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Write the results to this file instead of stdout", "file");
+    parser.addOptions({imageOption, scalesOption, runsOption, outputOption});
+    parser.process(application);
+
+    const QString imageFile = parser.value(imageOption);
+    if (!QFile::exists(imageFile)) {
+        QTextStream(stderr) << "Image " << imageFile << " doesn't exist\n";
+        return 1;
+    }
+
+    QJsonObject report = createReport();
+    report["image"] = imageFile;
+    report["runs"] = parser.value(runsOption).toInt();
+
+    DecompileBenchmark benchmark(qMax(1, parser.value(runsOption).toInt()));
+    QJsonArray results;
+    for (const QString &scale : splitCommaList(parser.value(scalesOption))) {
+        if (scale.toInt() <= 0) {
+            continue;
+        }
+        QTextStream(stderr) << "Decompiling " << scale << " copies\n";
+        results.append(benchmark.run(imageFile, scale.toInt()));
+    }
+    report["results"] = results;
+
+    return writeReport(report, parser.value(outputOption)) ? 0 : 1;
+}
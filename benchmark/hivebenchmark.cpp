@@ -0,0 +1,251 @@
+#include "hivewidget.h"
+#include "toolcommon.h"
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QThreadPool>
+#include <QThread>
+#include <QPainter>
+#include <QTextStream>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <random>
+#include <cmath>
+
+// From this many edges on the memory per edge has to stay within HiveGraph::edgeMemoryBudget()
+static const int s_budgetCheckEdges = 1000000;
+
+struct GraphConfig {
+    int nodeCount = 1000;
+    int groupCount = 3;
+    int subgroupCount = 12;
+    double degree = 5;
+    bool powerLaw = false;
+};
+
+// Has access to the internals of HiveWidget, so each step can be timed on its own
+class HiveBenchmark
+{
+public:
+    HiveBenchmark(int width, int height, int runs) : m_runs(runs) {
+        m_widget.resize(width, height);
+    }
+
+    QJsonObject run(const GraphConfig &config, bool threadScaling);
+
+private:
+    static void generateGraph(const GraphConfig &config, QVector<Node> *nodes, QVector<Edge> *edges);
+
+    HiveWidget m_widget;
+    int m_runs;
+};
+
+void HiveBenchmark::generateGraph(const GraphConfig &config, QVector<Node> *nodes, QVector<Edge> *edges)
+{
+    // Fixed seed, so runs are comparable across commits
+    std::mt19937 random(1337);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+
+    // Every subgroup belongs to exactly one group, like classes do
+    nodes->reserve(config.nodeCount);
+    for (int i=0; i<config.nodeCount; i++) {
+        const int subgroup = random() % config.subgroupCount;
+        const int group = subgroup % config.groupCount;
+
+        Node node;
+        node.group = QString("group%1").arg(group);
+        node.subgroup = QString("group%1.subgroup%2").arg(group).arg(subgroup);
+        node.displayName = QString::number(i);
+        nodes->append(node);
+    }
+
+    // With a power law a few nodes get most of the edges, both as sources and as targets, like the hub groups do
+    const double alpha = 2.5;
+    const double minimumDegree = config.degree * (alpha - 1) / alpha;
+    edges->reserve(int(config.nodeCount * config.degree));
+    for (int i=0; i<config.nodeCount; i++) {
+        int degree;
+        if (config.powerLaw) {
+            degree = qMin(int(minimumDegree / std::pow(1. - uniform(random), 1. / alpha)), config.nodeCount);
+        } else {
+            degree = config.degree;
+        }
+
+        for (int j=0; j<degree; j++) {
+            Edge edge;
+            edge.source = i;
+            if (config.powerLaw) {
+                edge.target = qMin(int(config.nodeCount * std::pow(uniform(random), 3)), config.nodeCount - 1);
+            } else {
+                edge.target = random() % config.nodeCount;
+            }
+            edge.isView = (random() % 4 == 0);
+            edges->append(edge);
+        }
+    }
+}
+
+QJsonObject HiveBenchmark::run(const GraphConfig &config, bool threadScaling)
+{
+    QVector<Node> nodes;
+    QVector<Edge> edges;
+    generateGraph(config, &nodes, &edges);
+
+    QJsonObject result;
+    result["nodes"] = nodes.count();
+    result["edges"] = edges.count();
+
+    // setNodes() clears the edges, so both are timed together and setNodes() on its own
+    result["setNodesMs"] = bestOf(m_runs, [&]() { m_widget.setNodes(nodes); });
+    result["setEdgesMs"] = bestOf(m_runs, [&]() {
+        m_widget.setNodes(nodes);
+        m_widget.setEdges(edges);
+    }) - result["setNodesMs"].toDouble();
+    result["calculateMs"] = bestOf(m_runs, [&]() { m_widget.calculate(); });
+    result["bytesPerEdge"] = double(m_widget.edgeMemoryUsage()) / qMax(edges.count(), 1);
+    result["bytesPerEdgeBudget"] = double(HiveWidget::edgeMemoryBudget());
+
+    QImage image(m_widget.size(), QImage::Format_ARGB32_Premultiplied);
+    QPainter painter(&image);
+
+    // The first frame after a layout renders the static layer, the following ones reuse it
+    m_widget.m_closest = -1;
+    result["paintColdMs"] = bestOf(m_runs, [&]() {
+        m_widget.invalidateBackground();
+        m_widget.paint(&painter);
+    });
+    result["paintMs"] = bestOf(m_runs, [&]() { m_widget.paint(&painter); });
+
+    // Hover the node with the most edges, the worst case for the overlay
+    int hub = 0;
+    for (int i=0; i<nodes.count(); i++) {
+        const int degree = m_widget.m_edgeOffsets[i + 1] - m_widget.m_edgeOffsets[i] + m_widget.m_inEdgeOffsets[i + 1] - m_widget.m_inEdgeOffsets[i];
+        const int hubDegree = m_widget.m_edgeOffsets[hub + 1] - m_widget.m_edgeOffsets[hub] + m_widget.m_inEdgeOffsets[hub + 1] - m_widget.m_inEdgeOffsets[hub];
+        if (degree > hubDegree) {
+            hub = i;
+        }
+    }
+    m_widget.m_closest = hub;
+    result["hoverDegree"] = m_widget.m_edgeOffsets[hub + 1] - m_widget.m_edgeOffsets[hub] + m_widget.m_inEdgeOffsets[hub + 1] - m_widget.m_inEdgeOffsets[hub];
+    result["paintHoverColdMs"] = bestOf(m_runs, [&]() {
+        m_widget.invalidateBackground();
+        m_widget.paint(&painter);
+    });
+    result["paintHoverMs"] = bestOf(m_runs, [&]() { m_widget.paint(&painter); });
+    m_widget.m_closest = -1;
+
+    // Zoomed in on the middle of the first axis, so the viewport culling kicks in
+    const double zoom = 16;
+    const Node &center = m_widget.m_nodes.at(nodes.count() / 2);
+    m_widget.m_zoom = zoom;
+    m_widget.m_pan = QPointF(m_widget.width() / 2., m_widget.height() / 2.) - QPointF(center.x, center.y) * zoom;
+    result["paintZoomedColdMs"] = bestOf(m_runs, [&]() {
+        m_widget.invalidateBackground();
+        m_widget.paint(&painter);
+    });
+    result["zoomedEdges"] = m_widget.m_edgeLayer.culled ? m_widget.m_edgeLayer.edges.count() : edges.count();
+    m_widget.m_zoom = 1;
+    m_widget.m_pan = QPointF();
+    m_widget.invalidateBackground();
+
+    // Random points all over the widget, most of them close to something
+    const int queries = 10000;
+    std::mt19937 random(42);
+    QVector<QPoint> points(queries);
+    for (QPoint &point : points) {
+        point = QPoint(random() % m_widget.width(), random() % m_widget.height());
+    }
+    int found = 0;
+    const double closestMs = bestOf(m_runs, [&]() {
+        found = 0;
+        for (const QPoint &point : points) {
+            found += (m_widget.closestTo(point) != -1);
+        }
+    });
+    result["getClosestUs"] = closestMs * 1000. / queries;
+    result["getClosestHitRate"] = double(found) / queries;
+
+    if (threadScaling) {
+        QJsonArray scaling;
+        const int maxThreads = QThread::idealThreadCount();
+        for (int threads = 1; ; threads = qMin(threads * 2, maxThreads)) {
+            QThreadPool::globalInstance()->setMaxThreadCount(threads);
+
+            QJsonObject sample;
+            sample["threads"] = threads;
+            sample["calculateMs"] = bestOf(m_runs, [&]() { m_widget.calculate(); });
+            scaling.append(sample);
+
+            if (threads >= maxThreads) {
+                break;
+            }
+        }
+        QThreadPool::globalInstance()->setMaxThreadCount(maxThreads);
+        result["threadScaling"] = scaling;
+    }
+
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    useOffscreenPlatform();
+    QApplication application(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times HiveWidget on synthetic graphs and prints the results as JSON");
+    parser.addHelpOption();
+    QCommandLineOption sizesOption("sizes", "Comma separated node counts", "counts", "1000,10000,100000,1000000");
+    QCommandLineOption groupsOption("groups", "Number of groups, i. e. axes", "count", "3");
+    QCommandLineOption subgroupsOption("subgroups", "Number of subgroups", "count", "12");
+    QCommandLineOption degreeOption("degree", "Average number of outgoing edges per node", "degree", "5");
+    QCommandLineOption distributionOption("distribution", "Degree distribution, uniform or powerlaw", "distribution", "uniform");
+    QCommandLineOption runsOption("runs", "Runs per measurement, the best one is reported", "runs", "3");
+    QCommandLineOption threadScalingOption("thread-scaling", "Also time the layout with a growing number of threads");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Write the results to this file instead of stdout", "file");
+    parser.addOptions({sizesOption, groupsOption, subgroupsOption, degreeOption, distributionOption, runsOption, threadScalingOption, outputOption});
+    parser.process(application);
+
+    GraphConfig config;
+    config.groupCount = qMax(1, parser.value(groupsOption).toInt());
+    config.subgroupCount = qMax(config.groupCount, parser.value(subgroupsOption).toInt());
+    config.degree = parser.value(degreeOption).toDouble();
+    config.powerLaw = (parser.value(distributionOption) == "powerlaw");
+
+    QJsonObject configJson;
+    configJson["groups"] = config.groupCount;
+    configJson["subgroups"] = config.subgroupCount;
+    configJson["degree"] = config.degree;
+    configJson["distribution"] = config.powerLaw ? "powerlaw" : "uniform";
+    configJson["runs"] = parser.value(runsOption).toInt();
+
+    QJsonObject report = createReport();
+    report["config"] = configJson;
+
+    HiveBenchmark benchmark(1920, 1080, qMax(1, parser.value(runsOption).toInt()));
+    QJsonArray results;
+    for (const QString &size : splitCommaList(parser.value(sizesOption))) {
+        config.nodeCount = size.toInt();
+        if (config.nodeCount <= 0) {
+            continue;
+        }
+        QTextStream(stderr) << "Running with " << config.nodeCount << " nodes\n";
+        results.append(benchmark.run(config, parser.isSet(threadScalingOption)));
+    }
+    report["results"] = results;
+
+    // Only checked on large graphs, on small ones the per-node offset tables dominate
+    bool withinBudget = true;
+    for (const QJsonValue &value : results) {
+        const QJsonObject result = value.toObject();
+        if (result["edges"].toInt() >= s_budgetCheckEdges && result["bytesPerEdge"].toDouble() > result["bytesPerEdgeBudget"].toDouble()) {
+            QTextStream(stderr) << result["bytesPerEdge"].toDouble() << " bytes per edge with " << result["edges"].toInt()
+                                << " edges, over the budget of " << result["bytesPerEdgeBudget"].toDouble() << "\n";
+            withinBudget = false;
+        }
+    }
+
+    if (!writeReport(report, parser.value(outputOption))) {
+        return 1;
+    }
+    return withinBudget ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include "replicodehandler.h"
+#include "toolcommon.h"
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QFile>
+#include <QTextStream>
+#include <QJsonObject>
+#include <QJsonArray>
+
+// Runs a source with one setting at a time and measures how fast the rmem grows
+class MemSweep
+{
+public:
+    MemSweep(const QString &sourceFile, int duration) : m_sourceFile(sourceFile), m_duration(duration) {}
+
+    QJsonObject run(const MemSettings &settings);
+
+private:
+    QString m_sourceFile;
+    int m_duration;
+};
+
+QJsonObject MemSweep::run(const MemSettings &settings)
+{
+    QJsonObject result;
+    result["reductionCores"] = int(settings.reductionCoreCount);
+    result["timeCores"] = int(settings.timeCoreCount);
+
+    // A fresh handler every time, compiling again would add to the image of the previous one
+    ReplicodeHandler handler;
+    QString errorString;
+    QObject::connect(&handler, &ReplicodeHandler::error, [&](const QString &error) { errorString = error; });
+    if (!handler.waitForInitialized()) {
+        result["error"] = "Unable to initialize replicode";
+        return result;
+    }
+    handler.setMemSettings(settings);
+
+    // Decompiling and copying the rmem for the perf objects would take time from the cores being measured
+    handler.setDecompiling(false);
+    handler.setPerfSampling(false);
+    RunStatistics statistics;
+    if (!handler.loadSource(m_sourceFile) || !handler.run(m_duration, &statistics)) {
+        result["error"] = errorString;
+        return result;
+    }
+
+    // Replicode doesn't count reductions, but every reduction injects its productions,
+    // so the growth of the rmem is the closest there is
+    result["seconds"] = statistics.seconds;
+    result["objectsBefore"] = statistics.objectsBefore;
+    result["objectsAfter"] = statistics.objectsAfter;
+    result["newObjectsPerSecond"] = (double(statistics.objectsAfter) - double(statistics.objectsBefore)) / statistics.seconds;
+
+    return result;
+}
+
+static QList<int> parseCounts(const QString &counts)
+{
+    QList<int> result;
+    for (const QString &count : splitCommaList(counts)) {
+        if (count.toInt() > 0) {
+            result.append(count.toInt());
+        }
+    }
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    useOffscreenPlatform();
+    QGuiApplication application(argc, argv);
+
+    // Shares the compile cache with the application
+    application.setApplicationName("repliqode");
+
+    // Powers of two up to what the machine has
+    QStringList defaultReductionCores;
+    for (int cores = 1; cores < QThread::idealThreadCount(); cores *= 2) {
+        defaultReductionCores.append(QString::number(cores));
+    }
+    defaultReductionCores.append(QString::number(QThread::idealThreadCount()));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs a source with different core counts and prints how fast the rmem grows as JSON");
+    parser.addHelpOption();
+    QCommandLineOption sourceOption("source", "Source file to run", "file");
+    QCommandLineOption durationOption("duration", "How long to run each setting, in milliseconds", "ms", "5000");
+    QCommandLineOption reductionCoresOption("reduction-cores", "Comma separated reduction core counts", "counts", defaultReductionCores.join(','));
+    QCommandLineOption timeCoresOption("time-cores", "Comma separated time core counts", "counts", "1,2");
+    QCommandLineOption autoTuneOption("auto-tune", "Also run with the core counts picked by the auto-tuning");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Write the results to this file instead of stdout", "file");
+    parser.addOptions({sourceOption, durationOption, reductionCoresOption, timeCoresOption, autoTuneOption, outputOption});
+    parser.process(application);
+
+    const QString sourceFile = parser.value(sourceOption);
+    if (!QFile::exists(sourceFile)) {
+        QTextStream(stderr) << "Source " << sourceFile << " doesn't exist\n";
+        return 1;
+    }
+
+    // The rest of the settings are the defaults, so runs are comparable across machines
+    QList<MemSettings> sweep;
+    for (int reductionCores : parseCounts(parser.value(reductionCoresOption))) {
+        for (int timeCores : parseCounts(parser.value(timeCoresOption))) {
+            MemSettings settings;
+            settings.reductionCoreCount = reductionCores;
+            settings.timeCoreCount = timeCores;
+            sweep.append(settings);
+        }
+    }
+    if (parser.isSet(autoTuneOption)) {
+        MemSettings settings;
+        settings.autoTune(QThread::idealThreadCount());
+        sweep.append(settings);
+    }
+
+    QJsonObject report = createReport();
+    report["source"] = sourceFile;
+    report["durationMs"] = parser.value(durationOption).toInt();
+
+    MemSweep memSweep(sourceFile, qMax(1, parser.value(durationOption).toInt()));
+    QJsonArray results;
+    QJsonObject best;
+    for (const MemSettings &settings : sweep) {
+        QTextStream(stderr) << "Running with " << settings.reductionCoreCount << " reduction cores and " << settings.timeCoreCount << " time cores\n";
+        const QJsonObject result = memSweep.run(settings);
+        if (result.contains("error")) {
+            QTextStream(stderr) << result["error"].toString() << "\n";
+        } else if (best.isEmpty() || result["newObjectsPerSecond"].toDouble() > best["newObjectsPerSecond"].toDouble()) {
+            best = result;
+        }
+        results.append(result);
+    }
+    report["results"] = results;
+    report["best"] = best;
+
+    return writeReport(report, parser.value(outputOption)) ? 0 : 1;
+}
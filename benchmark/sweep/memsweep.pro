@@ -0,0 +1,10 @@
+TARGET = memsweep
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+include(../../replicodehandler.pri)
+include(../../toolcommon.pri)
+
+SOURCES += memsweep.cpp
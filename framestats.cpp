@@ -0,0 +1,111 @@
+#include "framestats.h"
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+
+FrameStats::FrameStats(int windowSize) :
+    m_windowSize(windowSize)
+{
+    clear();
+}
+
+void FrameStats::record(FrameStats::Phase phase, qint64 microseconds)
+{
+    QVector<qint64> &samples = m_samples[phase];
+    if (samples.count() < m_windowSize) {
+        samples.append(microseconds);
+        return;
+    }
+
+    // Full, so overwrite the oldest
+    samples[m_nextSample[phase]] = microseconds;
+    m_nextSample[phase] = (m_nextSample[phase] + 1) % m_windowSize;
+}
+
+void FrameStats::clear()
+{
+    for (int phase = 0; phase < PhaseCount; phase++) {
+        m_samples[phase].clear();
+        m_samples[phase].reserve(m_windowSize);
+        m_nextSample[phase] = 0;
+    }
+}
+
+qint64 FrameStats::percentile(FrameStats::Phase phase, double fraction) const
+{
+    QVector<qint64> samples = m_samples[phase];
+    if (samples.isEmpty()) {
+        return 0;
+    }
+
+    const int index = qBound(0, int(fraction * samples.count()), samples.count() - 1);
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+qint64 FrameStats::maximum(FrameStats::Phase phase) const
+{
+    const QVector<qint64> &samples = m_samples[phase];
+    if (samples.isEmpty()) {
+        return 0;
+    }
+    return *std::max_element(samples.constBegin(), samples.constEnd());
+}
+
+QVector<int> FrameStats::histogram(FrameStats::Phase phase, int bucketCount, qint64 maxMicroseconds) const
+{
+    QVector<int> buckets(bucketCount, 0);
+    if (bucketCount == 0 || maxMicroseconds <= 0) {
+        return buckets;
+    }
+
+    for (qint64 sample : m_samples[phase]) {
+        const int bucket = qMin(int(sample * bucketCount / maxMicroseconds), bucketCount - 1);
+        buckets[bucket]++;
+    }
+    return buckets;
+}
+
+bool FrameStats::save(const QString &path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        return false;
+    }
+
+    QTextStream stream(&file);
+    stream << "phase,samples,p50_us,p95_us,p99_us,max_us\n";
+    for (int i = 0; i < PhaseCount; i++) {
+        const Phase phase = Phase(i);
+        stream << phaseName(phase) << ','
+               << sampleCount(phase) << ','
+               << percentile(phase, 0.50) << ','
+               << percentile(phase, 0.95) << ','
+               << percentile(phase, 0.99) << ','
+               << maximum(phase) << '\n';
+    }
+
+    return stream.status() == QTextStream::Ok;
+}
+
+QString FrameStats::phaseName(FrameStats::Phase phase)
+{
+    switch(phase) {
+    case Layout:
+        return "layout";
+    case BackgroundEdges:
+        return "background edges";
+    case Nodes:
+        return "nodes";
+    case OverlayEdges:
+        return "overlay edges";
+    case Labels:
+        return "labels";
+    case SourceDocument:
+        return "source document";
+    case Frame:
+        return "frame";
+    default:
+        return "unknown";
+    }
+}
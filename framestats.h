@@ -0,0 +1,44 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <QVector>
+#include <QString>
+
+// Rolling window of the most recent timings for each phase of drawing the hive plot
+class FrameStats
+{
+public:
+    enum Phase {
+        Layout,
+        BackgroundEdges,
+        Nodes,
+        OverlayEdges,
+        Labels,
+        SourceDocument,
+        Frame,
+        PhaseCount
+    };
+
+    FrameStats(int windowSize = 256);
+
+    void record(Phase phase, qint64 microseconds);
+    void clear();
+
+    int sampleCount(Phase phase) const { return m_samples[phase].count(); }
+    qint64 percentile(Phase phase, double fraction) const;
+    qint64 maximum(Phase phase) const;
+
+    // Number of samples in each of bucketCount equally wide buckets up to maxMicroseconds, the last one also gets everything above
+    QVector<int> histogram(Phase phase, int bucketCount, qint64 maxMicroseconds) const;
+
+    bool save(const QString &path) const;
+
+    static QString phaseName(Phase phase);
+
+private:
+    int m_windowSize;
+    QVector<qint64> m_samples[PhaseCount];
+    int m_nextSample[PhaseCount];
+};
+
+#endif // FRAMESTATS_H
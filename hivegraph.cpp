@@ -0,0 +1,729 @@
+#include "hivegraph.h"
+#include <qmath.h>
+#include <QFontMetrics>
+#include <QLinearGradient>
+#include <QHash>
+#include <QSet>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <algorithm>
+#include <limits>
+
+// Cell size of the grid the nodes are indexed in for hit-testing
+static const int s_nodeGridCellSize = 100;
+
+// Below this many edges per thread it isn't worth spreading the edge layout out
+static const int s_minEdgesPerThread = 1024;
+
+// Per-edge memory: source, target, control point, incoming edge index, spatial index entry and a bit for views,
+// plus the offset tables and bundles spread over the edges. Paths, arrowheads, brushes and bounding boxes are
+// only created while drawing. Checked by the benchmark, see edgeMemoryUsage().
+static const size_t s_edgeMemoryBudget = 28;
+
+// Finest level of the edge index has 2^(levels - 1) cells per side
+static const int s_edgeIndexLevels = 7;
+
+HiveGraph::HiveGraph()
+    : m_labelAscent(0),
+      m_lineHeight(0),
+      m_groupsXOffset(0),
+      m_axisLength(0),
+      m_scaleEdgeMax(false),
+      m_scaleAxis(true),
+      m_nodeGridColumns(0),
+      m_nodeGridRows(0)
+{
+}
+
+void HiveGraph::setNodes(const QVector<Node> &nodes)
+{
+    m_nodes = nodes;
+
+    // Existing edges refer to the old nodes
+    m_edgeSources.clear();
+    m_edgeTargets.clear();
+    m_edgeControlPoints.clear();
+    m_viewEdges.clear();
+    m_edgeOffsets = QVector<int>(m_nodes.count() + 1, 0);
+    m_inEdges.clear();
+    m_inEdgeOffsets = QVector<int>(m_nodes.count() + 1, 0);
+
+    internGroups();
+
+    m_labels.resize(m_nodes.count());
+    for (int id = 0; id < m_nodes.count(); id++) {
+        m_labels[id] = QStaticText(m_nodes[id].displayName);
+        m_labels[id].setTextFormat(Qt::PlainText);
+    }
+}
+
+QStringList HiveGraph::disabledSubgroups() const
+{
+    QStringList subgroups;
+    for (int subgroup = 0; subgroup < qMin(m_disabledSubgroups.size(), m_subgroups.count()); subgroup++) {
+        if (m_disabledSubgroups.testBit(subgroup)) {
+            subgroups.append(m_subgroups[subgroup]);
+        }
+    }
+    return subgroups;
+}
+
+void HiveGraph::setDisabledSubgroups(const QStringList &subgroups)
+{
+    QBitArray disabled(m_subgroups.count());
+    for (const QString &subgroup : subgroups) {
+        const int id = m_subgroups.indexOf(subgroup);
+        if (id != -1) {
+            disabled.setBit(id);
+        }
+    }
+    if (disabled == m_disabledSubgroups) {
+        return;
+    }
+    m_disabledSubgroups = disabled;
+    buildNodeIndex();
+}
+
+void HiveGraph::internGroups()
+{
+    // Hidden subgroups stay hidden when new ones show up, and across setNodes()
+    QSet<QString> disabledNames;
+    for (const QString &subgroup : disabledSubgroups()) {
+        disabledNames.insert(subgroup);
+    }
+
+    // Sorted so ids follow the legend and axis order
+    QSet<QString> groupSet;
+    QSet<QString> subgroupSet;
+    for (const Node &node : m_nodes) {
+        groupSet.insert(node.group);
+        subgroupSet.insert(node.subgroup);
+    }
+    m_groups = groupSet.values();
+    std::sort(m_groups.begin(), m_groups.end());
+    m_subgroups = subgroupSet.values();
+    std::sort(m_subgroups.begin(), m_subgroups.end());
+
+    QHash<QString, int> groupIds;
+    for (int i=0; i<m_groups.count(); i++) {
+        groupIds.insert(m_groups[i], i);
+    }
+    QHash<QString, int> subgroupIds;
+    for (int i=0; i<m_subgroups.count(); i++) {
+        subgroupIds.insert(m_subgroups[i], i);
+    }
+    for (Node &node : m_nodes) {
+        node.groupId = groupIds.value(node.group);
+        node.subgroupId = subgroupIds.value(node.subgroup);
+    }
+
+    m_disabledSubgroups = QBitArray(m_subgroups.count());
+    for (int subgroup = 0; subgroup < m_subgroups.count(); subgroup++) {
+        if (disabledNames.contains(m_subgroups[subgroup])) {
+            m_disabledSubgroups.setBit(subgroup);
+        }
+    }
+}
+
+void HiveGraph::setEdges(const QVector<Edge> &edges)
+{
+    const int nodeCount = m_nodes.count();
+
+    // Counting sort by source into CSR layout, keeping the original order within each node
+    m_edgeOffsets = QVector<int>(nodeCount + 1, 0);
+    for (const Edge &edge : edges) {
+        if (edge.source < 0 || edge.source >= nodeCount || edge.target < 0 || edge.target >= nodeCount) {
+            continue;
+        }
+        m_edgeOffsets[edge.source + 1]++;
+    }
+    for (int i=0; i<nodeCount; i++) {
+        m_edgeOffsets[i + 1] += m_edgeOffsets[i];
+    }
+
+    const int edgeCount = m_edgeOffsets[nodeCount];
+    m_edgeSources = QVector<qint32>(edgeCount);
+    m_edgeTargets = QVector<qint32>(edgeCount);
+    m_edgeControlPoints = QVector<EdgeControlPoint>(edgeCount);
+    m_viewEdges = QBitArray(edgeCount);
+    QVector<int> insertPositions = m_edgeOffsets;
+    for (const Edge &edge : edges) {
+        if (edge.source < 0 || edge.source >= nodeCount || edge.target < 0 || edge.target >= nodeCount) {
+            continue;
+        }
+        const int index = insertPositions[edge.source]++;
+        m_edgeSources[index] = edge.source;
+        m_edgeTargets[index] = edge.target;
+        m_viewEdges.setBit(index, edge.isView);
+    }
+
+    m_inEdgeOffsets = QVector<int>(nodeCount + 1, 0);
+    for (int target : m_edgeTargets) {
+        m_inEdgeOffsets[target + 1]++;
+    }
+    for (int i=0; i<nodeCount; i++) {
+        m_inEdgeOffsets[i + 1] += m_inEdgeOffsets[i];
+    }
+
+    m_inEdges = QVector<int>(edgeCount);
+    insertPositions = m_inEdgeOffsets;
+    for (int i=0; i<edgeCount; i++) {
+        m_inEdges[insertPositions[m_edgeTargets[i]]++] = i;
+    }
+}
+
+static quint64 edgeKey(int source, int target, bool isView)
+{
+    return (quint64(source) << 33) | (quint64(target) << 1) | quint64(isView);
+}
+
+bool HiveGraph::applyDiff(const GraphDiff &diff)
+{
+    if (diff.reset) {
+        setNodes(diff.addedNodes);
+        setEdges(diff.addedEdges);
+        return true;
+    }
+
+    if (diff.baseNodeCount != m_nodes.count()) {
+        return false;
+    }
+
+    for (int id : diff.removedNodes) {
+        if (id < 0 || id >= m_nodes.count()) {
+            continue;
+        }
+        m_nodes[id].removed = true;
+    }
+
+    // Back to a plain list for setEdges(), without the removed edges and the edges of removed nodes
+    QHash<quint64, int> removedEdges;
+    for (const Edge &edge : diff.removedEdges) {
+        removedEdges[edgeKey(edge.source, edge.target, edge.isView)]++;
+    }
+    QVector<Edge> edges;
+    edges.reserve(m_edgeTargets.count() + diff.addedEdges.count());
+    for (int i = 0; i < m_edgeTargets.count(); i++) {
+        Edge edge;
+        edge.source = m_edgeSources[i];
+        edge.target = m_edgeTargets[i];
+        edge.isView = m_viewEdges.testBit(i);
+        if (m_nodes.at(edge.source).removed || m_nodes.at(edge.target).removed) {
+            continue;
+        }
+
+        QHash<quint64, int>::iterator removed = removedEdges.find(edgeKey(edge.source, edge.target, edge.isView));
+        if (removed != removedEdges.end() && removed.value() > 0) {
+            removed.value()--;
+            continue;
+        }
+        edges.append(edge);
+    }
+    edges += diff.addedEdges;
+
+    if (!diff.addedNodes.isEmpty()) {
+        const int firstAdded = m_nodes.count();
+        m_nodes += diff.addedNodes;
+        internGroups();
+
+        m_labels.resize(m_nodes.count());
+        for (int id = firstAdded; id < m_nodes.count(); id++) {
+            m_labels[id] = QStaticText(m_nodes[id].displayName);
+            m_labels[id].setTextFormat(Qt::PlainText);
+        }
+    }
+
+    setEdges(edges);
+    return true;
+}
+
+void HiveGraph::layout(const QSize &size, const QFont &font, double zoom)
+{
+    m_layoutSize = size;
+
+    // For calculating group legend positions. Done even without anything else to lay out,
+    // so the legend always matches the current subgroups.
+    QFontMetrics fontMetrics(font);
+    int maxWidth = 0;
+    int textY = 20;
+
+    // Automatically generate some colors
+    m_subgroupColors.resize(m_subgroups.count());
+    m_subgroupYPositions.resize(m_subgroups.count());
+    const int hueStep = 359 / qMax(m_subgroups.count(), 1);
+    int hue = 0;
+    for (int subgroup = 0; subgroup < m_subgroups.count(); subgroup++) {
+        maxWidth = qMax(maxWidth, fontMetrics.horizontalAdvance(m_subgroups[subgroup]));
+        m_subgroupYPositions[subgroup] = textY;
+        textY += fontMetrics.height();
+
+        m_subgroupColors[subgroup] = QColor::fromHsv(hue, 128, 255);
+        hue += hueStep;
+    }
+    m_groupsXOffset = size.width() - maxWidth;
+
+    if (m_nodes.isEmpty() || m_edgeTargets.isEmpty()) {
+        m_nodeGrid.clear();
+        m_edgeIndex.clear();
+        return;
+    }
+
+    QVector<int> groupNumElements(m_groups.count(), 0);
+    for (const Node &node : m_nodes) {
+        if (node.removed) {
+            continue;
+        }
+        groupNumElements[node.groupId]++;
+    }
+    int maxGroupSize = *std::max_element(groupNumElements.constBegin(), groupNumElements.constEnd());
+
+    // Calculate some angles
+    const int cx = size.width() / 2;
+    const int cy =  size.height() / 1.75;
+    const double angleStep = (M_PI * 2) / m_groups.count();
+    const double axisLength = size.height() / 1.75 - 50;
+    double angle = M_PI / 6;
+    m_center = QPointF(cx, cy);
+    m_axisLength = axisLength;
+    m_groupAngles.resize(m_groups.count());
+    QVector<double> axisOffsets(m_groups.count());
+    for (int group = 0; group < m_groups.count(); group++) {
+        m_groupAngles[group] = angle;
+        axisOffsets[group] = 50;
+        angle += angleStep;
+    }
+
+    // Hidden nodes keep their place on the axis, so toggling groups doesn't move anything
+    for (Node &node : m_nodes) {
+        if (node.removed) {
+            continue;
+        }
+        node.x = cos(m_groupAngles[node.groupId]) * axisOffsets[node.groupId] + cx;
+        node.y = sin(m_groupAngles[node.groupId]) * axisOffsets[node.groupId] + cy;
+        node.color = m_subgroupColors[node.subgroupId];
+
+        double offsetStep;
+        if (m_scaleAxis) {
+            offsetStep = axisLength / (groupNumElements[node.groupId] + 1);
+        } else {
+            offsetStep = (axisLength - 100) / maxGroupSize;
+        }
+        axisOffsets[node.groupId] += offsetStep;
+    }
+
+    buildNodeIndex();
+    m_labelAscent = fontMetrics.ascent();
+    m_lineHeight = fontMetrics.height();
+    cullLabels(zoom);
+
+    createEdgeBrushes();
+
+    // Edges are independent once the nodes are placed, so contiguous ranges of them are laid out
+    // in parallel. Each edge is only written by the range that owns it, so the result is the same
+    // regardless of scheduling.
+    const int edgeCount = m_edgeTargets.count();
+    const int rangeCount = qBound(1, edgeCount / s_minEdgesPerThread, QThreadPool::globalInstance()->maxThreadCount());
+    const int rangeSize = (edgeCount + rangeCount - 1) / rangeCount;
+    QVector<QPair<int, int>> ranges;
+    for (int begin = 0; begin < edgeCount; begin += rangeSize) {
+        ranges.append(qMakePair(begin, qMin(begin + rangeSize, edgeCount)));
+    }
+
+    // Detach before handing out the pointer to the worker threads
+    EdgeControlPoint *controlPoints = m_edgeControlPoints.data();
+
+    QtConcurrent::blockingMap(ranges, [&](QPair<int, int> &range) {
+        for (int i = range.first; i < range.second; i++) {
+            const Node &node = m_nodes.at(m_edgeSources.at(i));
+            const Node &otherNode = m_nodes.at(m_edgeTargets.at(i));
+            const QPointF controlPoint = edgeControlPoint(QPointF(node.x, node.y), node.groupId, QPointF(otherNode.x, otherNode.y), otherNode.groupId);
+            controlPoints[i].x = controlPoint.x();
+            controlPoints[i].y = controlPoint.y();
+        }
+    });
+
+    buildEdgeIndex();
+    calculateBundles();
+}
+
+QPointF HiveGraph::edgeControlPoint(const QPointF &source, int sourceGroup, const QPointF &target, int targetGroup) const
+{
+    const double cx = m_center.x();
+    const double cy = m_center.y();
+
+    double magnitude = hypot(source.x() - cx, source.y() - cy);
+    double otherMagnitude = hypot(target.x() - cx, target.y() - cy);
+    double averageRadians = atan2(((source.y() - cy) + (target.y() - cy))/2, ((source.x() - cx) + (target.x() - cx))/2);
+
+    const double sourceAngle = m_groupAngles.at(sourceGroup);
+    const double targetAngle = m_groupAngles.at(targetGroup);
+    if (sourceAngle == targetAngle) {
+        averageRadians += (magnitude - otherMagnitude) / m_axisLength;
+    } else if (fmod(sourceAngle, M_PI) == fmod(targetAngle, M_PI)) {
+        averageRadians += (magnitude - otherMagnitude) / m_axisLength;
+    }
+
+    double averageMagnitude;
+    if (m_scaleEdgeMax) {
+        averageMagnitude = qMax(magnitude, otherMagnitude);
+    } else {
+        averageMagnitude = (magnitude + otherMagnitude) / 2;
+    }
+
+    return QPointF(cos(averageRadians) * averageMagnitude + cx, sin(averageRadians) * averageMagnitude + cy);
+}
+
+void HiveGraph::createEdgeBrushes()
+{
+    const int lineAlpha = 64;
+
+    QColor color(Qt::white);
+    color.setAlpha(lineAlpha / 3);
+    m_viewBrush = QBrush(color);
+    color.setAlpha(lineAlpha / 2);
+    m_viewHighlightBrush = QBrush(color);
+
+    // The gradients run from (0, 0) to (1, 0) and are mapped onto each edge when it is drawn
+    const int subgroupCount = m_subgroups.count();
+    m_pairBrushes.resize(subgroupCount * subgroupCount);
+    m_pairHighlightBrushes.resize(subgroupCount * subgroupCount);
+    for (int source = 0; source < subgroupCount; source++) {
+        for (int target = 0; target < subgroupCount; target++) {
+            // Create normal background brush
+            QLinearGradient gradient(0, 0, 1, 0);
+            QColor color = m_subgroupColors[source];
+            color.setAlpha(lineAlpha);
+            gradient.setColorAt(0, color);
+            color.setAlpha(lineAlpha / 2);
+            gradient.setColorAt(0.8, color);
+            color = m_subgroupColors[target];
+            color.setAlpha(lineAlpha / 3);
+            gradient.setColorAt(1, color);
+            m_pairBrushes[source * subgroupCount + target] = QBrush(gradient);
+
+            // Create more prominent highlighting brush
+            QLinearGradient highlightGradient(0, 0, 1, 0);
+            color = m_subgroupColors[source];
+            color.setAlpha(lineAlpha);
+            highlightGradient.setColorAt(0, color);
+            color.setAlpha(lineAlpha);
+            highlightGradient.setColorAt(0.8, color);
+            color = m_subgroupColors[target];
+            color.setAlpha(lineAlpha / 1.5);
+            highlightGradient.setColorAt(1, color);
+            m_pairHighlightBrushes[source * subgroupCount + target] = QBrush(highlightGradient);
+        }
+    }
+}
+
+QBrush HiveGraph::edgeBrush(int edge, bool highlight) const
+{
+    if (m_viewEdges.testBit(edge)) {
+        return highlight ? m_viewHighlightBrush : m_viewBrush;
+    }
+
+    const Node &source = m_nodes.at(m_edgeSources[edge]);
+    const Node &target = m_nodes.at(m_edgeTargets[edge]);
+    const int pair = source.subgroupId * m_subgroups.count() + target.subgroupId;
+    QBrush brush = highlight ? m_pairHighlightBrushes.at(pair) : m_pairBrushes.at(pair);
+
+    // Rotate and scale the shared gradient so it runs from the source to the target
+    const double dx = target.x - source.x;
+    const double dy = target.y - source.y;
+    brush.setTransform(QTransform(dx, dy, -dy, dx, source.x, source.y));
+    return brush;
+}
+
+void HiveGraph::calculateBundles()
+{
+    // One bundle per (source subgroup, target subgroup) pair, from the average source to the average target position
+    const int subgroupCount = m_subgroups.count();
+    QVector<int> bundleIndices(subgroupCount * subgroupCount, -1);
+    QVector<QPointF> sourceSums;
+    QVector<QPointF> targetSums;
+    m_bundles.clear();
+
+    for (int edge = 0; edge < m_edgeTargets.count(); edge++) {
+        const Node &node = m_nodes.at(m_edgeSources[edge]);
+        const Node &otherNode = m_nodes.at(m_edgeTargets[edge]);
+
+        int &bundleIndex = bundleIndices[node.subgroupId * subgroupCount + otherNode.subgroupId];
+        if (bundleIndex == -1) {
+            bundleIndex = m_bundles.count();
+
+            EdgeBundle bundle;
+            bundle.sourceSubgroup = node.subgroupId;
+            bundle.targetSubgroup = otherNode.subgroupId;
+            bundle.sourceGroup = node.groupId;
+            bundle.targetGroup = otherNode.groupId;
+            m_bundles.append(bundle);
+            sourceSums.append(QPointF());
+            targetSums.append(QPointF());
+        }
+
+        m_bundles[bundleIndex].count++;
+        sourceSums[bundleIndex] += QPointF(node.x, node.y);
+        targetSums[bundleIndex] += QPointF(otherNode.x, otherNode.y);
+    }
+
+    for (int i=0; i<m_bundles.count(); i++) {
+        EdgeBundle &bundle = m_bundles[i];
+        const QPointF source = sourceSums[i] / bundle.count;
+        const QPointF target = targetSums[i] / bundle.count;
+        const QPointF controlPoint = edgeControlPoint(source, bundle.sourceGroup, target, bundle.targetGroup);
+
+        bundle.path = QPainterPath();
+        bundle.path.moveTo(source);
+        bundle.path.quadTo(controlPoint, target);
+    }
+}
+
+void HiveGraph::buildNodeIndex()
+{
+    m_nodeGrid.clear();
+    m_nodeGridColumns = 0;
+    m_nodeGridRows = 0;
+
+    QRect bounds;
+    for (const Node &node : m_nodes) {
+        if (!isVisible(node)) {
+            continue;
+        }
+        bounds |= QRect(node.x, node.y, 1, 1);
+    }
+    if (bounds.isNull()) {
+        return;
+    }
+
+    m_nodeGridOrigin = bounds.topLeft();
+    m_nodeGridColumns = bounds.width() / s_nodeGridCellSize + 1;
+    m_nodeGridRows = bounds.height() / s_nodeGridCellSize + 1;
+    m_nodeGrid.resize(m_nodeGridColumns * m_nodeGridRows);
+
+    for (int id = 0; id < m_nodes.count(); id++) {
+        const Node &node = m_nodes.at(id);
+        if (!isVisible(node)) {
+            continue;
+        }
+        const int column = (node.x - m_nodeGridOrigin.x()) / s_nodeGridCellSize;
+        const int row = (node.y - m_nodeGridOrigin.y()) / s_nodeGridCellSize;
+        m_nodeGrid[row * m_nodeGridColumns + column].append({node.x, node.y, id});
+    }
+}
+
+void HiveGraph::buildEdgeIndex()
+{
+    m_edgeIndex.clear();
+    m_edgeIndexBounds = QRectF();
+
+    const int edgeCount = m_edgeTargets.count();
+    if (edgeCount == 0) {
+        return;
+    }
+
+    // QRectF::united() skips empty rects, and straight edges along an axis have empty boxes
+    double left = std::numeric_limits<double>::max();
+    double top = std::numeric_limits<double>::max();
+    double right = std::numeric_limits<double>::lowest();
+    double bottom = std::numeric_limits<double>::lowest();
+    for (int edge = 0; edge < edgeCount; edge++) {
+        const QRectF box = edgeBounds(edge);
+        left = qMin(left, box.left());
+        top = qMin(top, box.top());
+        right = qMax(right, box.right());
+        bottom = qMax(bottom, box.bottom());
+    }
+    m_edgeIndexBounds = QRectF(QPointF(left, top), QPointF(right, bottom));
+    const double extent = qMax(qMax(right - left, bottom - top), 1.);
+
+    // Counting sort into the cells, like the CSR edge arrays
+    m_edgeIndex.resize(s_edgeIndexLevels);
+    for (int level = 0; level < s_edgeIndexLevels; level++) {
+        m_edgeIndex[level].offsets = QVector<int>((1 << level) * (1 << level) + 1, 0);
+    }
+    QVector<int> edgeLevels(edgeCount);
+    QVector<int> edgeCells(edgeCount);
+    for (int edge = 0; edge < edgeCount; edge++) {
+        const QRectF box = edgeBounds(edge);
+        const double boxSize = qMax(box.width(), box.height());
+        int level = s_edgeIndexLevels - 1;
+        if (boxSize > 0) {
+            level = qBound(0, int(log2(extent / boxSize)), s_edgeIndexLevels - 1);
+        }
+        const int cellsPerSide = 1 << level;
+        const double cellSize = extent / cellsPerSide;
+        const int column = qMin(int((box.left() - left) / cellSize), cellsPerSide - 1);
+        const int row = qMin(int((box.top() - top) / cellSize), cellsPerSide - 1);
+
+        edgeLevels[edge] = level;
+        edgeCells[edge] = row * cellsPerSide + column;
+        m_edgeIndex[level].offsets[edgeCells[edge] + 1]++;
+    }
+
+    QVector<QVector<int>> insertPositions(s_edgeIndexLevels);
+    for (int level = 0; level < s_edgeIndexLevels; level++) {
+        QVector<int> &offsets = m_edgeIndex[level].offsets;
+        for (int cell = 0; cell < offsets.count() - 1; cell++) {
+            offsets[cell + 1] += offsets[cell];
+        }
+        m_edgeIndex[level].edges = QVector<int>(offsets.last());
+        insertPositions[level] = offsets;
+    }
+    for (int edge = 0; edge < edgeCount; edge++) {
+        const int level = edgeLevels[edge];
+        m_edgeIndex[level].edges[insertPositions[level][edgeCells[edge]]++] = edge;
+    }
+}
+
+QRectF HiveGraph::edgeBounds(int edge) const
+{
+    // The curve stays inside the triangle of its end points and control point
+    const Node &source = m_nodes.at(m_edgeSources[edge]);
+    const Node &target = m_nodes.at(m_edgeTargets[edge]);
+    const EdgeControlPoint &controlPoint = m_edgeControlPoints[edge];
+
+    const double left = qMin(qMin<double>(source.x, target.x), controlPoint.x);
+    const double top = qMin(qMin<double>(source.y, target.y), controlPoint.y);
+    const double right = qMax(qMax<double>(source.x, target.x), controlPoint.x);
+    const double bottom = qMax(qMax<double>(source.y, target.y), controlPoint.y);
+    return QRectF(QPointF(left, top), QPointF(right, bottom));
+}
+
+QVector<int> HiveGraph::edgesIn(const QRectF &rect) const
+{
+    QVector<int> edges;
+    if (m_edgeIndex.isEmpty()) {
+        return edges;
+    }
+
+    const double extent = qMax(qMax(m_edgeIndexBounds.width(), m_edgeIndexBounds.height()), 1.);
+    for (int level = 0; level < m_edgeIndex.count(); level++) {
+        const EdgeIndexLevel &index = m_edgeIndex[level];
+        const int cellsPerSide = 1 << level;
+        const double cellSize = extent / cellsPerSide;
+
+        // Boxes are stored by their top left corner and are at most a cell large,
+        // so they can reach into the rect from one cell further up and left
+        const int firstColumn = qMax(qFloor((rect.left() - m_edgeIndexBounds.left()) / cellSize) - 1, 0);
+        const int lastColumn = qMin(qFloor((rect.right() - m_edgeIndexBounds.left()) / cellSize), cellsPerSide - 1);
+        const int firstRow = qMax(qFloor((rect.top() - m_edgeIndexBounds.top()) / cellSize) - 1, 0);
+        const int lastRow = qMin(qFloor((rect.bottom() - m_edgeIndexBounds.top()) / cellSize), cellsPerSide - 1);
+
+        for (int row = firstRow; row <= lastRow; row++) {
+            for (int column = firstColumn; column <= lastColumn; column++) {
+                const int cell = row * cellsPerSide + column;
+                for (int i = index.offsets[cell]; i < index.offsets[cell + 1]; i++) {
+                    const int edge = index.edges[i];
+                    const QRectF box = edgeBounds(edge);
+                    if (box.right() >= rect.left() && box.left() <= rect.right() && box.bottom() >= rect.top() && box.top() <= rect.bottom()) {
+                        edges.append(edge);
+                    }
+                }
+            }
+        }
+    }
+
+    // Same drawing order as without culling
+    std::sort(edges.begin(), edges.end());
+    return edges;
+}
+
+QVector<int> HiveGraph::nodesIn(const QRectF &rect) const
+{
+    QVector<int> nodes;
+    if (m_nodeGrid.isEmpty()) {
+        return nodes;
+    }
+
+    const int firstColumn = qMax(qFloor((rect.left() - m_nodeGridOrigin.x()) / s_nodeGridCellSize), 0);
+    const int lastColumn = qMin(qFloor((rect.right() - m_nodeGridOrigin.x()) / s_nodeGridCellSize), m_nodeGridColumns - 1);
+    const int firstRow = qMax(qFloor((rect.top() - m_nodeGridOrigin.y()) / s_nodeGridCellSize), 0);
+    const int lastRow = qMin(qFloor((rect.bottom() - m_nodeGridOrigin.y()) / s_nodeGridCellSize), m_nodeGridRows - 1);
+    for (int row = firstRow; row <= lastRow; row++) {
+        for (int column = firstColumn; column <= lastColumn; column++) {
+            for (const IndexedNode &node : m_nodeGrid[row * m_nodeGridColumns + column]) {
+                if (rect.contains(node.x, node.y)) {
+                    nodes.append(node.id);
+                }
+            }
+        }
+    }
+    return nodes;
+}
+
+void HiveGraph::cullLabels(double zoom)
+{
+    // Labels closer than a line apart along an axis just overlap, so only the first of them is drawn.
+    // They don't grow when zooming in, so more of them fit.
+    const double spacing = m_lineHeight / zoom;
+    QVector<double> lastLabeled(m_groups.count(), -spacing);
+
+    m_labeledNodes = QBitArray(m_nodes.count());
+    for (int id = 0; id < m_nodes.count(); id++) {
+        const Node &node = m_nodes.at(id);
+        if (!isVisible(node)) {
+            continue;
+        }
+        const double axisOffset = hypot(node.x - m_center.x(), node.y - m_center.y());
+        if (axisOffset - lastLabeled[node.groupId] < spacing) {
+            continue;
+        }
+        lastLabeled[node.groupId] = axisOffset;
+        m_labeledNodes.setBit(id);
+    }
+}
+
+int HiveGraph::getClosest(double x, double y, double radius, const QRectF &visible) const
+{
+    if (m_nodeGrid.isEmpty()) {
+        return -1;
+    }
+
+    // Floor division, so points left of or above the grid map to negative cells
+    const int column = qFloor((x - m_nodeGridOrigin.x()) / s_nodeGridCellSize);
+    const int row = qFloor((y - m_nodeGridOrigin.y()) / s_nodeGridCellSize);
+
+    // Enough neighbouring cells to cover every node within the radius
+    const int reach = qMax(qCeil(radius / s_nodeGridCellSize), 1);
+    double minDist = radius;
+    int closest = -1;
+    for (int r = qMax(row - reach, 0); r <= qMin(row + reach, m_nodeGridRows - 1); r++) {
+        for (int c = qMax(column - reach, 0); c <= qMin(column + reach, m_nodeGridColumns - 1); c++) {
+            for (const IndexedNode &node : m_nodeGrid[r * m_nodeGridColumns + c]) {
+                if (!visible.contains(node.x, node.y)) {
+                    continue;
+                }
+                double dist = hypot(x - node.x, y - node.y);
+                if (dist < minDist) {
+                    minDist = dist;
+                    closest = node.id;
+                }
+            }
+        }
+    }
+    return closest;
+}
+
+size_t HiveGraph::edgeMemoryUsage() const
+{
+    size_t usage = m_edgeSources.capacity() * sizeof(qint32) +
+            m_edgeTargets.capacity() * sizeof(qint32) +
+            m_edgeControlPoints.capacity() * sizeof(EdgeControlPoint) +
+            m_inEdges.capacity() * sizeof(int) +
+            m_viewEdges.size() / 8 +
+            m_edgeOffsets.capacity() * sizeof(int) +
+            m_inEdgeOffsets.capacity() * sizeof(int) +
+            m_bundles.capacity() * sizeof(EdgeBundle);
+    for (const EdgeIndexLevel &level : m_edgeIndex) {
+        usage += level.edges.capacity() * sizeof(int) + level.offsets.capacity() * sizeof(int);
+    }
+    for (const EdgeBundle &bundle : m_bundles) {
+        usage += bundle.path.elementCount() * sizeof(QPainterPath::Element);
+    }
+    return usage;
+}
+
+size_t HiveGraph::edgeMemoryBudget()
+{
+    return s_edgeMemoryBudget;
+}
@@ -0,0 +1,181 @@
+#ifndef HIVEGRAPH_H
+#define HIVEGRAPH_H
+
+#include <QVector>
+#include <QBitArray>
+#include <QStringList>
+#include <QColor>
+#include <QBrush>
+#include <QFont>
+#include <QPainterPath>
+#include <QStaticText>
+#include <QMetaType>
+
+struct Node {
+    QString displayName;
+    QString group;
+    QString subgroup;
+
+    // Index of the object in the decompiled image, used to create the source document on demand
+    int objectIndex = -1;
+
+    // Interned by HiveGraph::setNodes()
+    int groupId = 0;
+    int subgroupId = 0;
+
+    QColor color;
+    int x = 0, y = 0;
+
+    // Set by HiveGraph::applyDiff(), removed nodes keep their id until the next setNodes()
+    bool removed = false;
+};
+
+struct Edge {
+    bool isView = false;
+
+    // Indices into the node array
+    int source = -1;
+    int target = -1;
+
+    bool operator==(const Edge &other) {
+        return (source == other.source && target == other.target);
+    }
+};
+
+struct EdgeControlPoint {
+    float x = 0;
+    float y = 0;
+};
+
+// Every edge between two subgroups, drawn as a single curve
+struct EdgeBundle {
+    int sourceSubgroup = 0;
+    int targetSubgroup = 0;
+    int sourceGroup = 0;
+    int targetGroup = 0;
+    int count = 0;
+
+    QPainterPath path;
+};
+
+// What changed in the graph between two samples of a running rmem. Added nodes get the ids
+// following the current ones. With reset set it holds the whole graph in the added nodes and edges.
+struct GraphDiff {
+    bool reset = false;
+    int baseNodeCount = 0;
+
+    QVector<Node> addedNodes;
+    QVector<int> removedNodes;
+    QVector<Edge> addedEdges;
+    QVector<Edge> removedEdges;
+
+    bool isEmpty() const {
+        return !reset && addedNodes.isEmpty() && removedNodes.isEmpty() && addedEdges.isEmpty() && removedEdges.isEmpty();
+    }
+};
+Q_DECLARE_METATYPE(GraphDiff)
+
+// The nodes and edges of the hive plot and their layout, without anything tied to a widget,
+// so a new graph can be built and laid out on a worker thread
+class HiveGraph
+{
+public:
+    HiveGraph();
+
+    void setNodes(const QVector<Node> &nodes);
+    void setEdges(const QVector<Edge> &edges);
+    // False if the diff was made against a different graph, it isn't applied then
+    bool applyDiff(const GraphDiff &diff);
+    void layout(const QSize &size, const QFont &font, double zoom);
+
+    // Hidden subgroups by name, they stay hidden across setNodes() and diffs. Setting them after
+    // layout() rebuilds the node index if anything changed.
+    QStringList disabledSubgroups() const;
+    void setDisabledSubgroups(const QStringList &subgroups);
+
+    // Bytes allocated for the edges, and how much that may be per edge on large graphs
+    size_t edgeMemoryUsage() const;
+    static size_t edgeMemoryBudget();
+
+protected:
+    void internGroups();
+    void calculateBundles();
+    void createEdgeBrushes();
+    QBrush edgeBrush(int edge, bool highlight) const;
+    QPointF edgeControlPoint(const QPointF &source, int sourceGroup, const QPointF &target, int targetGroup) const;
+    void buildNodeIndex();
+    void buildEdgeIndex();
+    QRectF edgeBounds(int edge) const;
+    QVector<int> edgesIn(const QRectF &rect) const;
+    QVector<int> nodesIn(const QRectF &rect) const;
+    void cullLabels(double zoom);
+    // Closest node within radius of (x, y) that is also inside visible, all in layout coordinates
+    int getClosest(double x, double y, double radius, const QRectF &visible) const;
+
+    bool isVisible(const Node &node) const { return !node.removed && !m_disabledSubgroups.testBit(node.subgroupId); }
+    bool isEdgeVisible(int edge) const { return isVisible(m_nodes[m_edgeSources[edge]]) && isVisible(m_nodes[m_edgeTargets[edge]]); }
+
+    QVector<Node> m_nodes;
+
+    // Edges as a struct of arrays sorted by source, the outgoing edges of node n are m_edgeOffsets[n] up to m_edgeOffsets[n + 1]
+    QVector<qint32> m_edgeSources;
+    QVector<qint32> m_edgeTargets;
+    QVector<EdgeControlPoint> m_edgeControlPoints;
+    QBitArray m_viewEdges;
+    QVector<int> m_edgeOffsets;
+
+    // Same layout for incoming edges, holding edge indices
+    QVector<int> m_inEdges;
+    QVector<int> m_inEdgeOffsets;
+
+    // Shared by all edges between the same pair of subgroups, indexed by source subgroup * subgroup count + target subgroup
+    QVector<QBrush> m_pairBrushes;
+    QVector<QBrush> m_pairHighlightBrushes;
+    QBrush m_viewBrush;
+    QBrush m_viewHighlightBrush;
+
+    QVector<EdgeBundle> m_bundles;
+
+    // Shaped once per node, only the nodes in m_labeledNodes get a label in the static layer
+    QVector<QStaticText> m_labels;
+    QBitArray m_labeledNodes;
+    int m_labelAscent;
+    int m_lineHeight;
+
+    QStringList m_groups;
+    QStringList m_subgroups;
+    QVector<QColor> m_subgroupColors;
+    QVector<int> m_subgroupYPositions;
+    int m_groupsXOffset;
+    QPointF m_center;
+    double m_axisLength;
+    QVector<double> m_groupAngles;
+    bool m_scaleEdgeMax;
+    bool m_scaleAxis;
+
+    // The size layout() last ran with
+    QSize m_layoutSize;
+
+    QBitArray m_disabledSubgroups;
+
+    // Uniform grid over visible node positions, for hit-testing
+    struct IndexedNode {
+        int x, y;
+        int id;
+    };
+    QVector<QVector<IndexedNode>> m_nodeGrid;
+    QPoint m_nodeGridOrigin;
+    int m_nodeGridColumns;
+    int m_nodeGridRows;
+
+    // Loose quadtree of edge bounding boxes. Level l has 2^l cells per side, and each edge is stored
+    // once, on the finest level where its box fits in a cell, in the cell holding its top left corner.
+    struct EdgeIndexLevel {
+        QVector<int> offsets;
+        QVector<int> edges;
+    };
+    QVector<EdgeIndexLevel> m_edgeIndex;
+    QRectF m_edgeIndexBounds;
+};
+
+#endif // HIVEGRAPH_H
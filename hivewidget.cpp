@@ -4,196 +4,701 @@
 #include <QPainter>
 #include <QElapsedTimer>
 #include <QMouseEvent>
+#include <QWheelEvent>
+#include <QtConcurrent>
+#include <QTimer>
 #include <algorithm>
 
+// How long progressive rendering may spend on edges each frame, in nanoseconds
+static const qint64 s_frameBudget = 8 * 1000 * 1000;
+
+// How many highlighted source documents to keep around
+static const int s_sourceDocumentCacheSize = 64;
+
+// How long the size has to stay the same before a resize lays everything out again
+static const int s_relayoutDelay = 150;
+
+// Same for zooming and panning, until then the current layers are scaled and moved
+static const int s_viewDelay = 100;
+static const double s_minZoom = 0.5;
+static const double s_maxZoom = 64;
+
+// Hovering and clicking only picks nodes within this many pixels of the cursor
+static const int s_hitRadius = 100;
+
+// Labels are drawn right of their node, so nodes a bit left of the viewport can still have theirs in view
+static const int s_labelMargin = 300;
+
 HiveWidget::HiveWidget(QWidget *parent)
     : QOpenGLWidget(parent),
-      m_scaleEdgeMax(false),
-      m_scaleAxis(true),
-      m_renderTime(0)
+      m_closest(-1),
+      m_clicked(-1),
+      m_bundleEdges(false),
+      m_showTimings(false),
+      m_progressiveRendering(false),
+      m_renderTime(0),
+      m_relayoutTimer(new QTimer(this)),
+      m_zoom(1),
+      m_viewTimer(new QTimer(this)),
+      m_dragging(false),
+      m_graphGeneration(0),
+      m_graphWatcher(new QFutureWatcher<PreparedGraph>(this)),
+      m_preparingGraph(false)
 {
     setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Preferred);
     setMouseTracking(true);
+
+    m_sourceDocuments.setMaxCost(s_sourceDocumentCacheSize);
+
+    m_relayoutTimer->setSingleShot(true);
+    m_relayoutTimer->setInterval(s_relayoutDelay);
+    connect(m_relayoutTimer, &QTimer::timeout, this, [=]() {
+        calculate();
+        update();
+    });
+
+    m_viewTimer->setSingleShot(true);
+    m_viewTimer->setInterval(s_viewDelay);
+    connect(m_viewTimer, &QTimer::timeout, this, [=]() {
+        cullLabels(m_zoom);
+        invalidateBackground();
+        update();
+    });
+
+    connect(m_graphWatcher, &QFutureWatcher<PreparedGraph>::finished, this, &HiveWidget::onGraphPrepared);
 }
 
 HiveWidget::~HiveWidget()
 {
-
+    // The worker refers to the generation counter
+    m_graphGeneration++;
+    m_graphWatcher->waitForFinished();
 }
 
-void HiveWidget::setNodes(const QMap<QString, Node> &nodes)
+void HiveWidget::setNodes(const QVector<Node> &nodes)
 {
-    m_nodes = nodes;
-    m_disabledGroups.clear();
+    // Anything still being prepared by setGraph(), and diffs against the old graph, are out of date
+    m_graphGeneration++;
+    m_pendingDiffs.clear();
+
+    HiveGraph::setNodes(nodes);
+    m_closest = -1;
+    m_clicked = -1;
+    m_sourceDocuments.clear();
+
     calculate();
     update();
 }
 
-void HiveWidget::setEdges(const QList<Edge> &edges)
+void HiveWidget::setEdges(const QVector<Edge> &edges)
 {
-    m_edges = edges;
+    m_graphGeneration++;
+    m_pendingDiffs.clear();
+
+    HiveGraph::setEdges(edges);
+
     calculate();
     update();
 }
 
+void HiveWidget::setGraph(const QVector<Node> &nodes, const QVector<Edge> &edges,
+                          const std::function<QTextDocument*(int objectIndex)> &sourceDocumentFactory)
+{
+    // Results of earlier calls are thrown away, and they stop at the next step they get to.
+    // Diffs still waiting were made against the graph this replaces.
+    const int generation = ++m_graphGeneration;
+    m_pendingDiffs.clear();
+    const std::atomic<int> *currentGeneration = &m_graphGeneration;
+    const QSize size = this->size();
+    const QFont font = this->font();
+    const double zoom = m_zoom;
+
+    m_preparingGraph = true;
+    m_graphWatcher->setFuture(QtConcurrent::run([=]() {
+        QElapsedTimer timer;
+        timer.start();
+
+        PreparedGraph prepared;
+        prepared.generation = generation;
+        prepared.sourceDocumentFactory = sourceDocumentFactory;
+        prepared.graph.setNodes(nodes);
+        if (*currentGeneration != generation) {
+            return prepared;
+        }
+        prepared.graph.setEdges(edges);
+        if (*currentGeneration != generation) {
+            return prepared;
+        }
+        prepared.graph.layout(size, font, zoom);
+        prepared.layoutTime = timer.nsecsElapsed() / 1000;
+        return prepared;
+    }));
+}
+
+void HiveWidget::onGraphPrepared()
+{
+    m_preparingGraph = false;
+    const PreparedGraph prepared = m_graphWatcher->result();
+    if (prepared.generation != m_graphGeneration) {
+        if (!prepared.fromDiffs) {
+            emit graphCanceled();
+        }
+        layoutPendingDiffs();
+        return;
+    }
+
+    if (prepared.resync) {
+        emit resyncNeeded();
+    }
+
+    // Swapped in with a single assignment, painting and hit-testing only ever see one graph. The prepared
+    // graph has the hidden subgroups from when it was started, the legend may have been clicked since.
+    const QStringList disabledSubgroups = HiveGraph::disabledSubgroups();
+    static_cast<HiveGraph &>(*this) = prepared.graph;
+    HiveGraph::setDisabledSubgroups(disabledSubgroups);
+    if (!prepared.fromDiffs) {
+        m_sourceDocumentFactory = prepared.sourceDocumentFactory;
+    }
+    if (!prepared.fromDiffs || prepared.reset) {
+        m_closest = -1;
+        m_clicked = -1;
+        m_sourceDocuments.clear();
+    }
+
+    // Removed nodes keep their id, but can't be hovered or clicked anymore
+    if (m_closest != -1 && m_nodes.at(m_closest).removed) {
+        m_closest = -1;
+    }
+    if (m_clicked != -1 && m_nodes.at(m_clicked).removed) {
+        m_clicked = -1;
+    }
+    m_frameStats.record(FrameStats::Layout, prepared.layoutTime);
+    invalidateBackground();
+
+    // The widget may have been resized or zoomed while the layout was running
+    if (m_layoutSize != size()) {
+        m_relayoutTimer->start();
+    }
+    cullLabels(m_zoom);
+
+    if (!prepared.fromDiffs) {
+        emit graphReady();
+    }
+    update();
+
+    layoutPendingDiffs();
+}
+
+void HiveWidget::applyDiff(const GraphDiff &diff)
+{
+    // Nothing is cancelled for a diff, it waits for whatever is being laid out
+    m_pendingDiffs.append(diff);
+    if (!m_preparingGraph) {
+        layoutPendingDiffs();
+    }
+}
+
+void HiveWidget::layoutPendingDiffs()
+{
+    if (m_pendingDiffs.isEmpty()) {
+        return;
+    }
+
+    // Applied to a copy of the current graph, the edge arrays are shared until the diff changes them.
+    // The generation stays the same, so setGraph() and setNodes() still win over the diffs.
+    const QVector<GraphDiff> diffs = m_pendingDiffs;
+    m_pendingDiffs.clear();
+    const HiveGraph graph = *this;
+    const int generation = m_graphGeneration;
+    const QSize size = this->size();
+    const QFont font = this->font();
+    const double zoom = m_zoom;
+
+    m_preparingGraph = true;
+    m_graphWatcher->setFuture(QtConcurrent::run([=]() {
+        QElapsedTimer timer;
+        timer.start();
+
+        PreparedGraph prepared;
+        prepared.graph = graph;
+        prepared.generation = generation;
+        prepared.fromDiffs = true;
+        for (const GraphDiff &diff : diffs) {
+            // The rest was made against the same wrong graph, the reset that follows replaces them all
+            if (!prepared.graph.applyDiff(diff)) {
+                qWarning() << "Graph diff for" << diff.baseNodeCount << "nodes doesn't match the graph shown";
+                prepared.resync = true;
+                break;
+            }
+            prepared.reset |= diff.reset;
+        }
+
+        // Positions along an axis depend on how many nodes share it, so this lays everything out again, once for all of them
+        prepared.graph.layout(size, font, zoom);
+        prepared.layoutTime = timer.nsecsElapsed() / 1000;
+        return prepared;
+    }));
+}
+
+void HiveWidget::setBundleEdges(bool bundleEdges)
+{
+    if (bundleEdges == m_bundleEdges) {
+        return;
+    }
+    m_bundleEdges = bundleEdges;
+    invalidateBackground();
+    update();
+}
+
+void HiveWidget::setProgressiveRendering(bool progressiveRendering)
+{
+    m_progressiveRendering = progressiveRendering;
+    update();
+}
+
 void HiveWidget::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    paint(&painter);
+}
+
+void HiveWidget::paint(QPainter *painter)
 {
     QElapsedTimer timer;
     timer.start();
 
-    QPainter painter(this);
-    painter.setRenderHint(QPainter::Antialiasing);
-    painter.fillRect(rect(), Qt::black);
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->fillRect(rect(), Qt::black);
 
-    if (m_nodes.isEmpty() || m_edges.isEmpty()) {
+    if (m_nodes.isEmpty() || m_edgeTargets.isEmpty()) {
         return;
     }
 
+    // Only the overlay depends on the hovered node, the rest is cached until the layout changes.
+    // Nodes are only drawn when nothing is hovered.
+    const bool dimmed = (m_closest != -1);
+    Layer &edgeLayer = dimmed ? m_dimmedEdgeLayer : m_edgeLayer;
+    if (!edgeLayer.complete) {
+        // In progressive mode each frame only draws as many edges as fit in the budget
+        renderEdgeLayer(&edgeLayer, dimmed, m_progressiveRendering ? s_frameBudget : -1);
+    }
+    if (!dimmed && m_nodeLayer.image.isNull()) {
+        m_nodeLayer = renderNodeLayer();
+    }
+
+    const QTransform transform = viewTransform() * layoutTransform();
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+    if (!edgeLayer.complete) {
+        // Show the coarse structure until all the edges are in
+        painter->setTransform(transform);
+        drawBundles(painter, dimmed);
+    }
+    drawLayer(painter, edgeLayer);
+    if (!dimmed) {
+        drawLayer(painter, m_nodeLayer);
+    }
+
+    painter->resetTransform();
+    drawLegend(painter);
+
     QFontMetrics fontMetrics(font());
     QString fpsMessage = QString("%1 ms rendertime").arg(m_renderTime);
-    painter.drawText(width() - fontMetrics.horizontalAdvance(fpsMessage) - 10, height() - fontMetrics.height() / 4, fpsMessage);
+    painter->drawText(width() - fontMetrics.horizontalAdvance(fpsMessage) - 10, height() - fontMetrics.height() / 4, fpsMessage);
+    painter->setTransform(transform);
 
-    QRect groupRect;
-    groupRect.moveRight(m_groupsXOffset);
-    groupRect.setHeight(fontMetrics.height());
-    groupRect.setWidth(width() - m_groupsXOffset);
+    if (m_closest != -1) {
+        drawOverlay(painter);
+    }
+
+    m_renderTime = timer.elapsed();
+    m_frameStats.record(FrameStats::Frame, timer.nsecsElapsed() / 1000);
 
-    for (const QString &groupName : m_groupColors.keys()) {
-        if (m_disabledGroups.contains(groupName)) {
-            painter.setPen(Qt::gray);
+    if (m_showTimings) {
+        painter->resetTransform();
+        drawTimings(painter);
+    }
+
+    if (!edgeLayer.complete) {
+        update();
+    }
+}
+
+void HiveWidget::drawOverlay(QPainter *painter)
+{
+    painter->setPen(Qt::NoPen);
+
+    const int outBegin = m_edgeOffsets[m_closest];
+    const int outEnd = m_edgeOffsets[m_closest + 1];
+    const int inBegin = m_inEdgeOffsets[m_closest];
+    const int inEnd = m_inEdgeOffsets[m_closest + 1];
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Draw active edges on top
+    for (int edge = outBegin; edge < outEnd; edge++) {
+        if (!isEdgeVisible(edge)) {
+            continue;
+        }
+        QColor color;
+        if (m_viewEdges.testBit(edge)) {
+            color = QColor(Qt::white);
         } else {
-            painter.setPen(m_groupColors.value(groupName));
+            color = m_nodes.at(m_edgeSources[edge]).color;
         }
-        painter.drawText(groupRect, Qt::AlignVCenter | Qt::AlignLeft, groupName);
-        groupRect.moveTop(m_groupYPositions.value(groupName));
+        color.setAlpha(192);
+        drawEdge(painter, edge, color);
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(color);
+        painter->drawPolygon(arrowhead(edge));
     }
 
-    // Draw underlying edges first
-    painter.setPen(Qt::NoPen);
-    for (const Edge &edge : m_edges) {
-        if (m_disabledGroups.contains(m_nodes[edge.source].subgroup) || m_disabledGroups.contains(m_nodes[edge.target].subgroup)) {
+    // Draw twice, for subtle highlight
+    for (int i = inBegin; i < inEnd; i++) {
+        const int edge = m_inEdges[i];
+        if (!isEdgeVisible(edge)) {
             continue;
         }
-        if (edge.source == m_closest) {
+        const QBrush brush = edgeBrush(edge, true);
+        drawEdge(painter, edge, brush);
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(brush);
+        painter->drawPolygon(arrowhead(edge));
+    }
+
+    m_frameStats.record(FrameStats::OverlayEdges, timer.nsecsElapsed() / 1000);
+    timer.restart();
+
+    // Labels and markers keep their size when zoomed, only their positions follow the view
+    const QTransform transform = painter->transform();
+    painter->resetTransform();
+
+    QColor penColor(Qt::white);
+    const Node &closest = m_nodes.at(m_closest);
+    const QPointF closestPosition = transform.map(QPointF(closest.x, closest.y));
+    painter->setBrush(closest.color);
+    painter->drawEllipse(closestPosition, 5, 5);
+    painter->setPen(penColor);
+    drawLabel(painter, closestPosition + QPointF(5, 0), m_closest);
+
+    // Draw text and highlight positions of related edges
+    penColor.setAlpha(192);
+    painter->setPen(penColor);
+    for (int edge = outBegin; edge < outEnd; edge++) {
+        if (!isEdgeVisible(edge)) {
             continue;
         }
-        if (m_closest.isEmpty()) {
-            painter.setBrush(edge.highlightBrush);
-        } else {
-            painter.setBrush(edge.brush);
+        const int target = m_edgeTargets[edge];
+        const Node &node = m_nodes.at(target);
+        drawLabel(painter, transform.map(QPointF(node.x, node.y)) + QPointF(10, 5), target);
+    }
+    penColor.setAlpha(128);
+    painter->setPen(penColor);
+    for (int i = inBegin; i < inEnd; i++) {
+        const int edge = m_inEdges[i];
+        const int source = m_edgeSources[edge];
+        // Self references are already labeled as outgoing
+        if (source == m_closest || !isEdgeVisible(edge)) {
+            continue;
         }
-        painter.drawPath(edge.path);
+        const Node &node = m_nodes.at(source);
+        drawLabel(painter, transform.map(QPointF(node.x, node.y)), source);
     }
 
-    // Draw nodes
-    QPen nodePen;
-    nodePen.setWidth(5);
-    if (m_closest.isEmpty()) {
-        for (const QString &nodeName : m_nodes.keys()) {
-            const Node &node = m_nodes.value(nodeName);
-            if (m_disabledGroups.contains(node.subgroup)) {
-                continue;
-            }
+    m_frameStats.record(FrameStats::Labels, timer.nsecsElapsed() / 1000);
+    timer.restart();
+
+    // Draw source code of current node
+    QTextDocument *source = sourceDocument(m_closest);
+    if (source) {
+        source->drawContents(painter);
+    }
+    m_frameStats.record(FrameStats::SourceDocument, timer.nsecsElapsed() / 1000);
+}
 
-            QColor color(node.color);
-            color.setAlpha(128);
-            nodePen.setColor(color);
-            painter.setPen(nodePen);
-            painter.drawPoint(node.x, node.y);
-            painter.drawText(node.x, node.y, node.displayName);
+void HiveWidget::drawTimings(QPainter *painter)
+{
+    QFontMetrics fontMetrics(font());
+    const int lineHeight = fontMetrics.height();
+    const int columnWidth = fontMetrics.horizontalAdvance("0000000");
+    const int nameWidth = fontMetrics.horizontalAdvance(FrameStats::phaseName(FrameStats::BackgroundEdges)) + 10;
+    const int histogramHeight = 50;
+
+    QRect area(10, height() - lineHeight * (FrameStats::PhaseCount + 2) - histogramHeight - 20, nameWidth + columnWidth * 3 + 10, 0);
+    area.setBottom(height() - 10);
+    painter->fillRect(area, QColor(0, 0, 0, 192));
+
+    painter->setPen(Qt::white);
+    int y = area.top() + lineHeight;
+    painter->drawText(area.left() + 5, y, "µs");
+    painter->drawText(area.left() + 5 + nameWidth, y, "p50");
+    painter->drawText(area.left() + 5 + nameWidth + columnWidth, y, "p95");
+    painter->drawText(area.left() + 5 + nameWidth + columnWidth * 2, y, "p99");
+
+    for (int i = 0; i < FrameStats::PhaseCount; i++) {
+        const FrameStats::Phase phase = FrameStats::Phase(i);
+        y += lineHeight;
+        painter->drawText(area.left() + 5, y, FrameStats::phaseName(phase));
+        if (m_frameStats.sampleCount(phase) == 0) {
+            continue;
         }
+        painter->drawText(area.left() + 5 + nameWidth, y, QString::number(m_frameStats.percentile(phase, 0.50)));
+        painter->drawText(area.left() + 5 + nameWidth + columnWidth, y, QString::number(m_frameStats.percentile(phase, 0.95)));
+        painter->drawText(area.left() + 5 + nameWidth + columnWidth * 2, y, QString::number(m_frameStats.percentile(phase, 0.99)));
     }
-    painter.setPen(Qt::NoPen);
 
-    if (m_closest.isEmpty()) {
-        m_renderTime = timer.elapsed();
+    // Frame times, from zero up to the slowest frame
+    const qint64 maxFrameTime = m_frameStats.maximum(FrameStats::Frame);
+    const QVector<int> histogram = m_frameStats.histogram(FrameStats::Frame, 32, maxFrameTime + 1);
+    const int maxCount = *std::max_element(histogram.constBegin(), histogram.constEnd());
+    if (maxCount == 0) {
         return;
     }
 
+    const QRect histogramRect(area.left() + 5, area.bottom() - histogramHeight - 5, area.width() - 10, histogramHeight);
+    const double barWidth = double(histogramRect.width()) / histogram.count();
+    for (int i = 0; i < histogram.count(); i++) {
+        const double barHeight = double(histogram[i]) * histogramRect.height() / maxCount;
+        painter->fillRect(QRectF(histogramRect.left() + i * barWidth, histogramRect.bottom() - barHeight, barWidth - 1, barHeight), Qt::gray);
+    }
+    painter->drawText(histogramRect.left(), histogramRect.top(), QString("frame 0 - %1 µs").arg(maxFrameTime));
+}
 
-    // Draw active edges on top
-    for (const Edge &edge : m_edges) {
-        if (m_disabledGroups.contains(m_nodes[edge.source].subgroup) || m_disabledGroups.contains(m_nodes[edge.target].subgroup)) {
-            continue;
+void HiveWidget::setShowTimings(bool showTimings)
+{
+    m_showTimings = showTimings;
+    update();
+}
+
+bool HiveWidget::saveTimings(const QString &path) const
+{
+    return m_frameStats.save(path);
+}
+
+HiveWidget::Layer HiveWidget::createLayer() const
+{
+    const qreal pixelRatio = devicePixelRatioF();
+    Layer layer;
+    layer.image = QImage(m_layoutSize * pixelRatio, QImage::Format_ARGB32_Premultiplied);
+    layer.image.setDevicePixelRatio(pixelRatio);
+    layer.image.fill(Qt::transparent);
+    layer.view = viewTransform();
+    layer.viewport = layer.view.inverted().mapRect(QRectF(QPointF(0, 0), QSizeF(m_layoutSize)));
+    return layer;
+}
+
+void HiveWidget::drawLayer(QPainter *painter, const Layer &layer) const
+{
+    // Layers rendered before a resize, zoom or pan are stretched and moved to fit until they are re-rendered
+    painter->setTransform(layer.view.inverted() * viewTransform() * layoutTransform());
+    painter->drawImage(0, 0, layer.image);
+}
+
+void HiveWidget::drawLegend(QPainter *painter)
+{
+    QFontMetrics fontMetrics(font());
+    QRect groupRect;
+    groupRect.moveRight(m_groupsXOffset);
+    groupRect.setHeight(fontMetrics.height());
+    groupRect.setWidth(m_layoutSize.width() - m_groupsXOffset);
+
+    for (int subgroup = 0; subgroup < m_subgroups.count(); subgroup++) {
+        if (m_disabledSubgroups.testBit(subgroup)) {
+            painter->setPen(Qt::gray);
+        } else {
+            painter->setPen(m_subgroupColors[subgroup]);
         }
-        if (edge.source == m_closest) {
-            QColor color;
-            if (edge.isView) {
-                color = QColor(Qt::white);
-            } else {
-                color = m_nodes.value(edge.source).color;
-            }
-            color.setAlpha(192);
-            painter.setBrush(color);
-            painter.drawPath(edge.path);
-            painter.drawPolygon(edge.arrowhead);
+        painter->drawText(groupRect, Qt::AlignVCenter | Qt::AlignLeft, m_subgroups[subgroup]);
+        groupRect.moveTop(m_subgroupYPositions[subgroup]);
+    }
+}
+
+void HiveWidget::drawBundles(QPainter *painter, bool dimmed)
+{
+    // Width grows with the log of the number of edges in the bundle
+    painter->setBrush(Qt::NoBrush);
+    for (const EdgeBundle &bundle : m_bundles) {
+        if (m_disabledSubgroups.testBit(bundle.sourceSubgroup) || m_disabledSubgroups.testBit(bundle.targetSubgroup)) {
+            continue;
         }
+        QColor color = m_subgroupColors[bundle.sourceSubgroup];
+        color.setAlpha(dimmed ? 64 : 128);
+        QPen pen(color, 1 + log2(bundle.count));
+        pen.setCosmetic(true);
+        painter->setPen(pen);
+        painter->drawPath(bundle.path);
+    }
+}
 
-        // Draw twice, for subtle highlight
-        if (edge.target == m_closest) {
-            painter.setBrush(edge.highlightBrush);
-            painter.drawPath(edge.path);
-            painter.drawPolygon(edge.arrowhead);
+void HiveWidget::renderEdgeLayer(Layer *layer, bool dimmed, qint64 budget)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    if (layer->image.isNull()) {
+        *layer = createLayer();
+
+        // With everything in view the index would only add work
+        layer->culled = !layer->viewport.contains(m_edgeIndexBounds);
+        if (layer->culled) {
+            layer->edges = edgesIn(layer->viewport);
         }
     }
 
-    QColor penColor(Qt::white);
-    const Node &closest = m_nodes.value(m_closest);
-    painter.setBrush(closest.color);
-    painter.drawEllipse(closest.x - 5, closest.y - 5, 10, 10);
-    painter.setPen(penColor);
-    painter.drawText(closest.x + 5, closest.y, closest.displayName);
+    QPainter painter(&layer->image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setTransform(layer->view);
 
-    // Draw text and highlight positions of related edges
-    for (const Edge &edge : m_edges) {
-        if (m_disabledGroups.contains(m_nodes[edge.source].subgroup) || m_disabledGroups.contains(m_nodes[edge.target].subgroup)) {
-            continue;
+    if (m_bundleEdges) {
+        drawBundles(&painter, dimmed);
+        layer->complete = true;
+        m_frameStats.record(FrameStats::BackgroundEdges, timer.nsecsElapsed() / 1000);
+        return;
+    }
+
+    // Checking the clock for every edge would cost more than drawing some of them
+    const int edgeCount = layer->culled ? layer->edges.count() : m_edgeTargets.count();
+    int i = layer->nextEdge;
+    for (; i < edgeCount; i++) {
+        if (budget >= 0 && i > layer->nextEdge && i % 64 == 0 && timer.nsecsElapsed() > budget) {
+            break;
         }
-        if (edge.source == m_closest) {
-            const Node &node = m_nodes.value(edge.target);
-            penColor.setAlpha(192);
-            painter.setPen(penColor);
-            painter.drawText(node.x + 10, node.y + 5, node.displayName);
-        } else if (edge.target == m_closest) {
-            const Node &node = m_nodes.value(edge.source);
-            penColor.setAlpha(128);
-            painter.setPen(penColor);
-            painter.drawText(node.x, node.y, node.displayName);
+        const int edge = layer->culled ? layer->edges[i] : i;
+        if (!isEdgeVisible(edge)) {
+            continue;
         }
+        drawEdge(&painter, edge, edgeBrush(edge, !dimmed));
     }
+    layer->nextEdge = i;
+    layer->complete = (i == edgeCount);
 
-    // Draw source code of current node
-    if (m_nodes.value(m_closest).sourcecode) {
-        m_nodes.value(m_closest).sourcecode->drawContents(&painter);
+    m_frameStats.record(FrameStats::BackgroundEdges, timer.nsecsElapsed() / 1000);
+}
+
+HiveWidget::Layer HiveWidget::renderNodeLayer()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    Layer layer = createLayer();
+    QPainter painter(&layer.image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setFont(font());
+
+    // Nodes and labels keep their size when zoomed, so they are drawn untransformed at their position in the view
+    const double labelMargin = s_labelMargin / m_zoom;
+    QPen nodePen;
+    nodePen.setWidth(5);
+    for (int id : nodesIn(layer.viewport.adjusted(-labelMargin, -labelMargin, labelMargin, labelMargin))) {
+        const Node &node = m_nodes.at(id);
+        const QPointF position = layer.view.map(QPointF(node.x, node.y));
+
+        QColor color(node.color);
+        color.setAlpha(128);
+        nodePen.setColor(color);
+        painter.setPen(nodePen);
+        painter.drawPoint(position);
+        if (m_labeledNodes.testBit(id)) {
+            drawLabel(&painter, position, id);
+        }
     }
+    layer.complete = true;
 
-    m_renderTime = timer.elapsed();
+    painter.end();
+    m_frameStats.record(FrameStats::Nodes, timer.nsecsElapsed() / 1000);
+
+    return layer;
 }
 
-QString HiveWidget::getClosest(int x, int y)
+void HiveWidget::drawLabel(QPainter *painter, const QPointF &position, int nodeId)
 {
-    double minDist = width();
-    QString closest;
-    for (const QString &nodeName : m_nodes.keys()) {
-        if (m_disabledGroups.contains(m_nodes[nodeName].subgroup)) {
-            continue;
-        }
+    // Static text is positioned by its top left corner, not by the baseline like drawText()
+    painter->drawStaticText(position - QPointF(0, m_labelAscent), m_labels[nodeId]);
+}
 
-        int nodeX = m_nodes.value(nodeName).x;
-        int nodeY = m_nodes.value(nodeName).y;
-        double dist = hypot(x - nodeX, y - nodeY);
-        if (dist < 100 && dist < minDist) {
-            minDist = dist;
-            closest = nodeName;
-        }
+QTextDocument *HiveWidget::sourceDocument(int nodeId)
+{
+    const int objectIndex = m_nodes.at(nodeId).objectIndex;
+    if (objectIndex == -1 || !m_sourceDocumentFactory) {
+        return nullptr;
+    }
+
+    QTextDocument *document = m_sourceDocuments.object(objectIndex);
+    if (document) {
+        return document;
     }
-    return closest;
+
+    document = m_sourceDocumentFactory(objectIndex);
+    if (!document) {
+        return nullptr;
+    }
+    m_sourceDocuments.insert(objectIndex, document);
+    return document;
+}
+
+QTransform HiveWidget::layoutTransform() const
+{
+    if (m_layoutSize.isEmpty() || m_layoutSize == size()) {
+        return QTransform();
+    }
+
+    // The axes are centered at (width / 2, height / 1.75) and scale with the height
+    const double scale = double(height()) / m_layoutSize.height();
+    QTransform transform;
+    transform.translate(width() / 2., height() / 1.75);
+    transform.scale(scale, scale);
+    transform.translate(-m_layoutSize.width() / 2., -m_layoutSize.height() / 1.75);
+    return transform;
+}
+
+QTransform HiveWidget::viewTransform() const
+{
+    QTransform transform;
+    transform.translate(m_pan.x(), m_pan.y());
+    transform.scale(m_zoom, m_zoom);
+    return transform;
+}
+
+int HiveWidget::closestTo(const QPoint &pos) const
+{
+    // The hit radius is in widget pixels, so it shrinks in the layout when zooming in,
+    // and nodes scrolled out of view can't be hit
+    const QTransform toLayout = (viewTransform() * layoutTransform()).inverted();
+    const QPointF layoutPosition = toLayout.map(QPointF(pos));
+    return getClosest(layoutPosition.x(), layoutPosition.y(), s_hitRadius * qAbs(toLayout.m11()), toLayout.mapRect(QRectF(rect())));
+}
+
+void HiveWidget::setView(double zoom, const QPointF &pan)
+{
+    m_zoom = zoom;
+    m_pan = pan;
+
+    // Re-rendering on every wheel step or mouse move would make big graphs crawl
+    m_viewTimer->start();
+    update();
+}
+
+void HiveWidget::invalidateBackground()
+{
+    // Also restarts progressive rendering
+    m_edgeLayer = Layer();
+    m_dimmedEdgeLayer = Layer();
+    m_nodeLayer = Layer();
 }
 
 void HiveWidget::mouseMoveEvent(QMouseEvent *event)
 {
-    QString closest = getClosest(event->x(), event->y());
-    if (closest.isEmpty()) {
+    if (m_dragging) {
+        // Pan in view coordinates, which only differ from widget coordinates while a resize is pending
+        const QTransform inverseLayout = layoutTransform().inverted();
+        const QPointF delta = inverseLayout.map(QPointF(event->pos())) - inverseLayout.map(QPointF(m_dragPosition));
+        m_dragPosition = event->pos();
+        setView(m_zoom, m_pan + delta);
+        return;
+    }
+
+    int closest = closestTo(event->pos());
+    if (closest == -1) {
         closest = m_clicked;
     }
     if (closest != m_closest) {
@@ -204,212 +709,137 @@ void HiveWidget::mouseMoveEvent(QMouseEvent *event)
 
 void HiveWidget::mousePressEvent(QMouseEvent *event)
 {
-    // Check if clicked on group
+    // Check if clicked on group, the legend isn't zoomed
     QFontMetrics fontMetrics(font());
     QRect groupRect;
     groupRect.moveRight(m_groupsXOffset);
     groupRect.setHeight(fontMetrics.height());
-    groupRect.setWidth(width() - m_groupsXOffset);
-    for (const QString &groupName : m_groupYPositions.keys()) {
+    groupRect.setWidth(m_layoutSize.width() - m_groupsXOffset);
+    const int subgroupCount = qMin(m_subgroupYPositions.count(), m_disabledSubgroups.size());
+    for (int subgroup = 0; subgroup < subgroupCount; subgroup++) {
         if (groupRect.contains(event->pos())) {
-            if (m_disabledGroups.contains(groupName)) {
-                m_disabledGroups.removeAll(groupName);
-            } else {
-                m_disabledGroups.append(groupName);
+            // Positions and edge paths don't depend on what is hidden, so only visibility changes
+            m_disabledSubgroups.toggleBit(subgroup);
+            if (m_closest != -1 && !HiveGraph::isVisible(m_nodes.at(m_closest))) {
+                m_closest = -1;
+            }
+            if (m_clicked != -1 && !HiveGraph::isVisible(m_nodes.at(m_clicked))) {
+                m_clicked = -1;
             }
-            calculate();
+            buildNodeIndex();
+            cullLabels(m_zoom);
+            invalidateBackground();
             update();
             return;
         }
-        groupRect.moveTop(m_groupYPositions.value(groupName));
+        groupRect.moveTop(m_subgroupYPositions[subgroup]);
     }
 
+    if (event->button() == Qt::LeftButton) {
+        m_dragging = true;
+        m_dragPosition = event->pos();
+    }
 
-    QString clicked = getClosest(event->x(), event->y());
+    int clicked = closestTo(event->pos());
     if (clicked != m_clicked) {
         m_clicked = clicked;
         update();
     }
 }
 
-void HiveWidget::resizeEvent(QResizeEvent *event)
+void HiveWidget::mouseReleaseEvent(QMouseEvent *event)
 {
-    calculate();
-    QOpenGLWidget::resizeEvent(event);
-    update();
+    if (event->button() == Qt::LeftButton) {
+        m_dragging = false;
+    }
 }
 
-void HiveWidget::calculate()
+void HiveWidget::mouseDoubleClickEvent(QMouseEvent *)
 {
-    QElapsedTimer timer;
-    timer.start();
-
-    if (m_nodes.isEmpty() || m_edges.isEmpty()) {
-        return;
-    }
-
-    // Get all groups and subgroups
-    QSet<QString> groupSet;
-    QSet<QString> subgroupSet;
-    QMap<QString, int> groupNumElements;
-    for (const Node &node : m_nodes.values()) {
-        groupSet.insert(node.group);
-        subgroupSet.insert(node.subgroup);
-        groupNumElements[node.group]++;
-    }
-
-    QStringList groups = groupSet.values();
-    std::sort(groups.begin(), groups.end());
-    QStringList subgroups = subgroupSet.values();
-    std::sort(subgroups.begin(), subgroups.end());
-
-    QList<int> groupCounts = groupNumElements.values();
-    int maxGroupSize = *std::max_element(groupCounts.begin(), groupCounts.end());
-
-
-    // For calculating group legend positions
-    QFontMetrics fontMetrics(font());
-    int maxWidth = 0;
-    int textY = 20;
-
-    // Automatically generate some colors
-    const int hueStep = 359 / subgroups.count();
-    int hue = 0;
-    for(const QString &subgroup : subgroups) {
-        maxWidth = qMax(maxWidth, fontMetrics.horizontalAdvance(subgroup));
-        m_groupYPositions.insert(subgroup, textY);
-        textY += fontMetrics.height();
-
-        m_groupColors.insert(subgroup, QColor::fromHsv(hue, 128, 255));
-        hue += hueStep;
-    }
-    m_groupsXOffset = width() - maxWidth;
-
-    // Calculate some angles
-    const int cx = width() / 2;
-    const int cy =  height() / 1.75;
-    const double angleStep = (M_PI * 2) / groups.count();
-    const double axisLength = height() / 1.75 - 50;
-    double angle = M_PI / 6;
-    QHash<QString, double> groupAngles;
-    QHash<QString, double> axisOffsets;
-    for(const QString &group : groups) {
-        groupAngles[group] = angle;
-        axisOffsets[group] = 50;
-        angle += angleStep;
-    }
-
-    for (const QString &nodeName : m_nodes.keys()) {
-        Node &node = m_nodes[nodeName];
-        if (m_disabledGroups.contains(node.subgroup)) {
-            continue;
-        }
+    // Back to the whole plot
+    setView(1, QPointF());
+}
 
-        node.x = cos(groupAngles[node.group]) * axisOffsets[node.group] + cx;
-        node.y = sin(groupAngles[node.group]) * axisOffsets[node.group] + cy;
-        node.color = m_groupColors.value(node.subgroup);
+void HiveWidget::wheelEvent(QWheelEvent *event)
+{
+    // Zoom around the cursor, so the point under it stays put
+    const double zoom = qBound(s_minZoom, m_zoom * pow(1.002, event->angleDelta().y()), s_maxZoom);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    const QPointF viewPosition = layoutTransform().inverted().map(event->position());
+#else
+    const QPointF viewPosition = layoutTransform().inverted().map(event->posF());
+#endif
+    const QPointF layoutPosition = viewTransform().inverted().map(viewPosition);
+    setView(zoom, viewPosition - layoutPosition * zoom);
+    event->accept();
+}
 
-        double offsetStep;
-        if (m_scaleAxis) {
-            offsetStep = axisLength / (groupNumElements.value(node.group) + 1);
-        } else {
-            offsetStep = (axisLength - 100) / maxGroupSize;
-        }
-        axisOffsets[node.group] += offsetStep;
+void HiveWidget::resizeEvent(QResizeEvent *event)
+{
+    // Laying out big graphs is slow, so stretch the current layout until the size settles
+    if (m_layoutSize.isEmpty()) {
+        calculate();
+    } else {
+        m_relayoutTimer->start();
     }
+    QOpenGLWidget::resizeEvent(event);
+    update();
+}
 
-    QPainterPathStroker stroker;
-    stroker.setWidth(1);
-
-    int lineAlpha = 64;
-
-    for (Edge &edge : m_edges) {
-        const Node &node = m_nodes.value(edge.source);
-        const Node &otherNode = m_nodes.value(edge.target);
-        if (m_disabledGroups.contains(node.subgroup) || m_disabledGroups.contains(otherNode.subgroup)) {
-            continue;
-        }
-
-        const double nodeX = node.x;
-        const double nodeY = node.y;
-        const double otherX = otherNode.x;
-        const double otherY = otherNode.y;
-
-        double magnitude = hypot(nodeX - cx, nodeY - cy);
-        double otherMagnitude = hypot(otherX - cx, otherY - cy);
-        double averageRadians = atan2(((nodeY - cy) + (otherY - cy))/2, ((nodeX - cx) + (otherX - cx))/2);
-
-        if (groupAngles[edge.source] == groupAngles[edge.target]) {
-            averageRadians += (magnitude - otherMagnitude) / axisLength;
-        } else if (fmod(groupAngles[edge.source], M_PI) == fmod(groupAngles[edge.target], M_PI)) {
-            averageRadians += (magnitude - otherMagnitude) / axisLength;
-        }
-
-        double averageMagnitude;
-        if (m_scaleEdgeMax) {
-            averageMagnitude = qMax(magnitude, otherMagnitude);
-        } else {
-            averageMagnitude = (magnitude + otherMagnitude) / 2;
-        }
-
-        QPointF controlPoint(cos(averageRadians) * averageMagnitude + cx, sin(averageRadians) * averageMagnitude + cy);
-
-        // Create normal background brush
-        if (edge.isView) {
-            QColor color(Qt::white);
-            color.setAlpha(lineAlpha / 3);
-            edge.brush = QBrush(color);
-        } else {
-            QLinearGradient gradient(nodeX, nodeY, otherX, otherY);
-            QColor color = node.color;
-            color.setAlpha(lineAlpha);
-            gradient.setColorAt(0, color);
-            color.setAlpha(lineAlpha / 2);
-            gradient.setColorAt(0.8, color);
-            color = otherNode.color;
-            color.setAlpha(lineAlpha / 3);
-            gradient.setColorAt(1, color);
-            edge.brush = QBrush(gradient);
-        }
+void HiveWidget::drawEdge(QPainter *painter, int edge, const QBrush &brush)
+{
+    const Node &source = m_nodes.at(m_edgeSources[edge]);
+    const Node &target = m_nodes.at(m_edgeTargets[edge]);
+    const EdgeControlPoint &controlPoint = m_edgeControlPoints[edge];
+
+    QPainterPath path;
+    path.moveTo(source.x, source.y);
+    path.quadTo(controlPoint.x, controlPoint.y, target.x, target.y);
+
+    // Cosmetic, so edges stay thin when zoomed in
+    QPen pen(brush, 1);
+    pen.setCosmetic(true);
+    painter->setPen(pen);
+    painter->setBrush(Qt::NoBrush);
+    painter->drawPath(path);
+}
 
-        // Create more prominent highlighting brush
-        if (edge.isView) {
-            QColor color(Qt::white);
-            color.setAlpha(lineAlpha / 2);
-            edge.highlightBrush = QBrush(color);
-        } else {
-            QLinearGradient gradient(nodeX, nodeY, otherX, otherY);
-            QColor color = node.color;
-            color.setAlpha(lineAlpha);
-            gradient.setColorAt(0, color);
-            color.setAlpha(lineAlpha);
-            gradient.setColorAt(0.8, color);
-            color = otherNode.color;
-            color.setAlpha(lineAlpha / 1.5);
-            gradient.setColorAt(1, color);
-            edge.highlightBrush = QBrush(gradient);
-        }
+QPolygonF HiveWidget::arrowhead(int edge) const
+{
+    const Node &target = m_nodes.at(m_edgeTargets[edge]);
+    const EdgeControlPoint &controlPoint = m_edgeControlPoints[edge];
+    const double otherX = target.x;
+    const double otherY = target.y;
+
+    // Same size on screen regardless of zoom
+    const double sourceAngle = atan2(controlPoint.y - otherY, controlPoint.x - otherX);
+    QPointF endPoint(cos(sourceAngle) * 5 / m_zoom + otherX, sin(sourceAngle) * 5 / m_zoom + otherY);
+
+    const double arrowSize = 25. / m_zoom;
+    double arrowAngle = sourceAngle - M_PI / 20;
+    QPointF arrowHeadLeft(otherX + cos(arrowAngle) * arrowSize,
+                          otherY + sin(arrowAngle) * arrowSize);
+
+    arrowAngle = sourceAngle + M_PI / 20;
+    QPointF arrowHeadRight(otherX + cos(arrowAngle) * arrowSize,
+                           otherY + sin(arrowAngle) * arrowSize);
+
+    QPolygonF polygon;
+    polygon << endPoint << arrowHeadLeft << arrowHeadRight;
+    return polygon;
+}
 
-        const double sourceAngle = atan2(controlPoint.y() - otherY, controlPoint.x() - otherX);
-        QPoint endPoint = QPoint(cos(sourceAngle) * 5 + otherX, sin(sourceAngle) * 5 + otherY);
-        QPainterPath path;
-        path.moveTo(nodeX, nodeY);
-        path.quadTo(controlPoint, QPoint(otherX, otherY));
-        edge.path = stroker.createStroke(path);
+void HiveWidget::calculate()
+{
+    QElapsedTimer timer;
+    timer.start();
 
-        // Draw an arrowhead
-        const double arrowSize = 25.;
-        double arrowAngle = sourceAngle - M_PI / 20;
-        QPoint arrowHeadLeft = QPoint(otherX + cos(arrowAngle) * arrowSize,
-                                      otherY + sin(arrowAngle) * arrowSize);
+    m_relayoutTimer->stop();
+    invalidateBackground();
 
-        arrowAngle = sourceAngle + M_PI / 20;
-        QPoint arrowHeadRight = QPoint(otherX + cos(arrowAngle) * arrowSize,
-                                       otherY + sin(arrowAngle) * arrowSize);
+    HiveGraph::layout(size(), font(), m_zoom);
 
-        edge.arrowhead = QPolygon();
-        edge.arrowhead << endPoint << arrowHeadLeft << arrowHeadRight;
-    }
+    m_frameStats.record(FrameStats::Layout, timer.nsecsElapsed() / 1000);
     if (timer.elapsed() > 0) {
         qDebug() << "calculating took" << timer.restart() << "ms";
     }
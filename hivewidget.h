@@ -2,37 +2,21 @@
 #define HIVEWIDGET_H
 
 #include <QOpenGLWidget>
-#include <QMultiMap>
 #include <QTextDocument>
-#include <QPainterPath>
-#include <memory>
+#include <QCache>
+#include <QImage>
+#include <QTransform>
+#include <QFutureWatcher>
+#include <atomic>
+#include <functional>
+#include "hivegraph.h"
+#include "framestats.h"
 
-struct Node {
-    QString displayName;
-    QString group;
-    QString subgroup;
-    std::shared_ptr<QTextDocument> sourcecode;
+class QTimer;
+class QPainter;
 
-    QColor color;
-    int x, y;
-};
-
-struct Edge {
-    bool isView = false;
-    QString source;
-    QString target;
-
-    QPainterPath path;
-    QPolygon arrowhead;
-    QBrush brush;
-    QBrush highlightBrush;
-
-    bool operator==(const Edge &other) {
-        return (source == other.source && target == other.target);
-    }
-};
-
-class HiveWidget : public QOpenGLWidget
+// Private inheritance, the graph is only ever changed through the widget so the cached layers stay valid
+class HiveWidget : public QOpenGLWidget, private HiveGraph
 {
     Q_OBJECT
 
@@ -40,31 +24,129 @@ public:
     HiveWidget(QWidget *parent = 0);
     ~HiveWidget();
 
-    void setNodes(const QMap<QString, Node> &nodes);
-    void setEdges(const QList<Edge> &edges);
+    void setNodes(const QVector<Node> &nodes);
+    void setEdges(const QVector<Edge> &edges);
+
+    // Builds and lays out the graph on a worker thread and swaps it in when done, see graphReady().
+    // Cancels anything still in flight from a previous call. The source document factory is called the first
+    // time the source of an object is shown, and the widget takes ownership of the document. It is swapped in
+    // along with the graph, so it has to work with the object indices of these nodes.
+    void setGraph(const QVector<Node> &nodes, const QVector<Edge> &edges,
+                  const std::function<QTextDocument*(int objectIndex)> &sourceDocumentFactory);
+
+    using HiveGraph::edgeMemoryUsage;
+    using HiveGraph::edgeMemoryBudget;
+
+public slots:
+    // Applied and laid out on a worker thread like setGraph(), in order and after anything setGraph() is still doing
+    void applyDiff(const GraphDiff &diff);
+    void setBundleEdges(bool bundleEdges);
+    void setShowTimings(bool showTimings);
+    void setProgressiveRendering(bool progressiveRendering);
+    bool saveTimings(const QString &path) const;
+
+signals:
+    void graphReady();
+
+    // Instead of graphReady() when the graph from setGraph() was replaced by setNodes() or setEdges() before it was done
+    void graphCanceled();
+
+    // A diff didn't match the graph shown, the next one has to be a reset
+    void resyncNeeded();
 
 protected:
     virtual void paintEvent(QPaintEvent *) override;
     virtual void mouseMoveEvent(QMouseEvent *) override;
     virtual void mousePressEvent(QMouseEvent*) override;
+    virtual void mouseReleaseEvent(QMouseEvent*) override;
+    virtual void mouseDoubleClickEvent(QMouseEvent*) override;
+    virtual void wheelEvent(QWheelEvent*) override;
     virtual void resizeEvent(QResizeEvent*) override;
 
+private slots:
+    void onGraphPrepared();
+
 private:
+    // Drives the private parts without a window
+    friend class HiveBenchmark;
+
+    void paint(QPainter *painter);
     void calculate();
-    QString getClosest(int x, int y);
-
-    QMap<QString, Node> m_nodes;
-    QList<Edge> m_edges;
-
-    QMap<QString, QColor> m_groupColors;
-    QMap<QString, int> m_groupYPositions;
-    int m_groupsXOffset;
-    QString m_closest;
-    QString m_clicked;
-    bool m_scaleEdgeMax;
-    bool m_scaleAxis;
+    void drawEdge(QPainter *painter, int edge, const QBrush &brush);
+    QPolygonF arrowhead(int edge) const;
+
+    // Rendered with the view transform it was created with, and only holds what was in view then
+    struct Layer {
+        QImage image;
+        QTransform view;
+        QRectF viewport;
+        bool culled = false;
+        QVector<int> edges;
+        int nextEdge = 0;
+        bool complete = false;
+    };
+    Layer createLayer() const;
+    void drawLayer(QPainter *painter, const Layer &layer) const;
+    void drawLegend(QPainter *painter);
+    void drawBundles(QPainter *painter, bool dimmed);
+    void renderEdgeLayer(Layer *layer, bool dimmed, qint64 budget);
+    Layer renderNodeLayer();
+    void drawLabel(QPainter *painter, const QPointF &position, int nodeId);
+    void drawOverlay(QPainter *painter);
+    void drawTimings(QPainter *painter);
+    QTextDocument *sourceDocument(int nodeId);
+    void invalidateBackground();
+    QTransform layoutTransform() const;
+    QTransform viewTransform() const;
+    int closestTo(const QPoint &pos) const;
+    void setView(double zoom, const QPointF &pan);
+    void layoutPendingDiffs();
+
+    // Only the most recently shown source documents are kept around
+    std::function<QTextDocument*(int objectIndex)> m_sourceDocumentFactory;
+    QCache<int, QTextDocument> m_sourceDocuments;
+
+    int m_closest;
+    int m_clicked;
+    bool m_bundleEdges;
+    bool m_showTimings;
+    bool m_progressiveRendering;
     int m_renderTime;
-    QStringList m_disabledGroups;
+    FrameStats m_frameStats;
+
+    // Resizes are applied as a transform until the layout runs again
+    QTimer *m_relayoutTimer;
+
+    // Zoom and pan on top of the layout, the layers are re-rendered once they have settled
+    double m_zoom;
+    QPointF m_pan;
+    QTimer *m_viewTimer;
+    bool m_dragging;
+    QPoint m_dragPosition;
+
+    // Static edge layers for when nothing is hovered and when the overlay is drawn on top, and the nodes
+    Layer m_edgeLayer;
+    Layer m_dimmedEdgeLayer;
+    Layer m_nodeLayer;
+
+    // A graph built by setGraph() or with diffs applied, only swapped in if no newer one has been asked for since
+    struct PreparedGraph {
+        HiveGraph graph;
+        std::function<QTextDocument*(int objectIndex)> sourceDocumentFactory;
+        qint64 layoutTime = 0;
+        int generation = 0;
+        bool fromDiffs = false;
+        bool reset = false;
+        bool resync = false;
+    };
+    std::atomic<int> m_graphGeneration;
+    QFutureWatcher<PreparedGraph> *m_graphWatcher;
+
+    // Until onGraphPrepared(), the watcher may already be done with the result still queued
+    bool m_preparingGraph;
+
+    // Waiting for the graph being prepared, they apply on top of it
+    QVector<GraphDiff> m_pendingDiffs;
 };
 
 #endif // HIVEWIDGET_H
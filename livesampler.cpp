@@ -0,0 +1,173 @@
+#include "livesampler.h"
+#include "replicodehandler.h"
+
+#include <r_code/image.h>
+#include <r_code/image_impl.h>
+#include <r_code/object.h>
+#include <r_comp/segments.h>
+#include <r_exec/mem.h>
+#include <QTimer>
+#include <algorithm>
+
+// Once there are more removed than live nodes the next sample sends the whole graph instead of a diff
+static const int s_minRemovedBeforeReset = 1000;
+
+LiveSampler::LiveSampler(r_exec::_Mem *mem, r_comp::Metadata *metadata, const QHash<quint32, QString> &names,
+                         const QHash<quint32, Node> &decompiledNodes) : QObject(),
+    m_mem(mem),
+    m_metadata(metadata),
+    m_names(names),
+    m_decompiledNodes(decompiledNodes),
+    m_timer(nullptr),
+    m_nodeCount(0),
+    m_synced(false)
+{
+}
+
+void LiveSampler::start(int interval)
+{
+    // Created here, so it belongs to the sampling thread
+    m_timer = new QTimer(this);
+    m_timer->setInterval(interval);
+    connect(m_timer, &QTimer::timeout, this, &LiveSampler::sample);
+    m_timer->start();
+
+    sample();
+}
+
+void LiveSampler::resync()
+{
+    m_synced = false;
+}
+
+void LiveSampler::sample()
+{
+    // Only copies the object list, the cores keep running
+    r_comp::Image *image = m_mem->get_objects();
+    const size_t objectCount = image->code_segment.objects.size();
+
+    // Same classification as ReplicodeHandler::decompileImage(), but without decompiling anything
+    QVector<quint32> oids;
+    QVector<bool> shown(objectCount, false);
+    QHash<quint32, Node> sampledNodes;
+    for (size_t i=0; i<objectCount; i++) {
+        r_code::SysObject *object = image->code_segment.objects[i];
+        const QString type = QString::fromStdString(m_metadata->classes_by_opcodes[object->code[0].asOpcode()].str_opcode);
+        const QString group = ReplicodeHandler::classGroup(type);
+        if (group.isEmpty()) {
+            continue;
+        }
+
+        // The rmem doesn't change the class of an object, so a decompiled node is still right
+        Node node = m_decompiledNodes.value(object->oid);
+        if (node.objectIndex == -1) {
+            node.group = group;
+            node.subgroup = type;
+            node.displayName = m_names.value(object->oid, QString("%1_%2").arg(type).arg(object->oid));
+            if (!node.displayName.contains(type)) {
+                node.displayName += " (" + type + ')';
+            }
+        }
+
+        shown[i] = true;
+        oids.append(object->oid);
+        sampledNodes.insert(object->oid, node);
+    }
+
+    // References in the image are indices into it, the diff needs something that stays the same between samples
+    QHash<quint32, QVector<Reference>> references;
+    for (size_t i=0; i<objectCount; i++) {
+        if (!shown[i]) {
+            continue;
+        }
+
+        r_code::SysObject *object = image->code_segment.objects[i];
+        QVector<Reference> &objectReferences = references[object->oid];
+        for (size_t j=0; j<object->views.size(); j++) {
+            r_code::SysView *view = object->views[j];
+            for (size_t k=0; k<view->references.size(); k++) {
+                const size_t target = view->references[k];
+                if (target < objectCount && shown[target]) {
+                    objectReferences.append({ image->code_segment.objects[target]->oid, true });
+                }
+            }
+        }
+        for (size_t j=0; j<object->references.size(); j++) {
+            const size_t target = object->references[j];
+            if (target < objectCount && shown[target]) {
+                objectReferences.append({ image->code_segment.objects[target]->oid, false });
+            }
+        }
+        std::sort(objectReferences.begin(), objectReferences.end());
+    }
+    delete image;
+
+    const int removedCount = m_nodeCount - m_nodeIds.count();
+    if (removedCount > qMax(m_nodeIds.count(), s_minRemovedBeforeReset)) {
+        m_synced = false;
+    }
+
+    GraphDiff diff;
+    if (!m_synced) {
+        diff.reset = true;
+        m_nodeIds.clear();
+        m_references.clear();
+        m_nodeCount = 0;
+    }
+    diff.baseNodeCount = m_nodeCount;
+
+    // The widget drops the edges of removed nodes itself
+    for (QHash<quint32, int>::iterator it = m_nodeIds.begin(); it != m_nodeIds.end();) {
+        if (sampledNodes.contains(it.key())) {
+            ++it;
+            continue;
+        }
+        diff.removedNodes.append(it.value());
+        m_references.remove(it.key());
+        it = m_nodeIds.erase(it);
+    }
+
+    for (quint32 oid : oids) {
+        if (m_nodeIds.contains(oid)) {
+            continue;
+        }
+        m_nodeIds.insert(oid, m_nodeCount++);
+        diff.addedNodes.append(sampledNodes.value(oid));
+    }
+
+    // When the references of an object change all its edges are replaced
+    for (quint32 oid : oids) {
+        const QVector<Reference> &current = references[oid];
+        QHash<quint32, QVector<Reference>>::iterator previous = m_references.find(oid);
+        if (previous != m_references.end() && previous.value() == current) {
+            continue;
+        }
+
+        const int source = m_nodeIds.value(oid);
+        if (previous != m_references.end()) {
+            for (const Reference &reference : previous.value()) {
+                if (!m_nodeIds.contains(reference.target)) {
+                    continue;
+                }
+                Edge edge;
+                edge.source = source;
+                edge.target = m_nodeIds.value(reference.target);
+                edge.isView = reference.isView;
+                diff.removedEdges.append(edge);
+            }
+        }
+        for (const Reference &reference : current) {
+            Edge edge;
+            edge.source = source;
+            edge.target = m_nodeIds.value(reference.target);
+            edge.isView = reference.isView;
+            diff.addedEdges.append(edge);
+        }
+        m_references.insert(oid, current);
+    }
+    m_synced = true;
+
+    if (!diff.isEmpty()) {
+        emit diffReady(diff);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef LIVESAMPLER_H
+#define LIVESAMPLER_H
+
+#include <QObject>
+#include <QHash>
+#include "hivegraph.h"
+
+namespace r_exec {
+class _Mem;
+}
+namespace r_comp {
+class Metadata;
+}
+
+class QTimer;
+
+// Periodically takes the objects of a running rmem and diffs them against the previous sample, by oid.
+// Lives on its own thread, the reduction and time cores are never stopped for it.
+class LiveSampler : public QObject
+{
+    Q_OBJECT
+public:
+    // Objects found in decompiledNodes are sent as those nodes, by oid, new ones are named from their type
+    LiveSampler(r_exec::_Mem *mem, r_comp::Metadata *metadata, const QHash<quint32, QString> &names,
+                const QHash<quint32, Node> &decompiledNodes);
+
+public slots:
+    void start(int interval);
+    void sample();
+
+    // The next sample sends the whole graph instead of a diff
+    void resync();
+
+signals:
+    void diffReady(const GraphDiff &diff);
+
+private:
+    struct Reference {
+        quint32 target;
+        bool isView;
+
+        bool operator==(const Reference &other) const { return target == other.target && isView == other.isView; }
+        bool operator<(const Reference &other) const { return target < other.target || (target == other.target && isView < other.isView); }
+    };
+
+    r_exec::_Mem *m_mem;
+    r_comp::Metadata *m_metadata;
+    QHash<quint32, QString> m_names;
+    QHash<quint32, Node> m_decompiledNodes;
+    QTimer *m_timer;
+
+    // Mirrors the ids HiveWidget gives the nodes, removed nodes keep theirs until the next reset
+    QHash<quint32, int> m_nodeIds;
+    QHash<quint32, QVector<Reference>> m_references;
+    int m_nodeCount;
+    bool m_synced;
+};
+
+#endif // LIVESAMPLER_H
@@ -0,0 +1,105 @@
+#include "perfchart.h"
+#include <QPainter>
+#include <QFile>
+#include <QTextStream>
+
+// Four minutes at the default perf sampling period
+static const int s_shownSamples = 960;
+
+// About ten hours at the default perf sampling period, older samples are dropped
+static const int s_maxSamples = 150000;
+
+PerfChart::PerfChart(QWidget *parent) : QWidget(parent)
+{
+    setMinimumHeight(80);
+}
+
+QSize PerfChart::sizeHint() const
+{
+    return QSize(200, 120);
+}
+
+bool PerfChart::save(const QString &path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        return false;
+    }
+
+    QTextStream stream(&file);
+    stream << "time_ms,reduction_latency_us,reduction_latency_delta_us,time_latency_us,time_latency_delta_us\n";
+    for (const PerfSample &sample : m_samples) {
+        stream << sample.time << ','
+               << sample.reductionLatency << ','
+               << sample.reductionLatencyDelta << ','
+               << sample.timeLatency << ','
+               << sample.timeLatencyDelta << '\n';
+    }
+
+    return stream.status() == QTextStream::Ok;
+}
+
+void PerfChart::addSample(const PerfSample &sample)
+{
+    if (m_samples.count() >= s_maxSamples) {
+        m_samples.remove(0, m_samples.count() - s_maxSamples + 1);
+    }
+    m_samples.append(sample);
+    update();
+}
+
+void PerfChart::clear()
+{
+    m_samples.clear();
+    update();
+}
+
+void PerfChart::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+
+    const QFontMetrics fontMetrics(font());
+    const int lineHeight = fontMetrics.height();
+    const QColor reductionColor(Qt::cyan);
+    const QColor timeColor(Qt::magenta);
+
+    if (m_samples.isEmpty()) {
+        painter.setPen(palette().color(QPalette::Text));
+        painter.drawText(rect(), Qt::AlignCenter, "No perf samples yet");
+        return;
+    }
+
+    const int first = qMax(0, m_samples.count() - s_shownSamples);
+    float maxLatency = 1;
+    for (int i = first; i < m_samples.count(); i++) {
+        maxLatency = qMax(maxLatency, qMax(m_samples[i].reductionLatency, m_samples[i].timeLatency));
+    }
+
+    // Room for the legend at the top, the scale follows the highest latency in view
+    const QRectF area(0, lineHeight + 4, width() - 1, height() - lineHeight - 5);
+    const double xStep = area.width() / qMax(s_shownSamples - 1, 1);
+    QPolygonF reductionLine;
+    QPolygonF timeLine;
+    for (int i = first; i < m_samples.count(); i++) {
+        const double x = area.left() + (i - first) * xStep;
+        reductionLine.append(QPointF(x, area.bottom() - area.height() * m_samples[i].reductionLatency / maxLatency));
+        timeLine.append(QPointF(x, area.bottom() - area.height() * m_samples[i].timeLatency / maxLatency));
+    }
+
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(reductionColor);
+    painter.drawPolyline(reductionLine);
+    painter.setPen(timeColor);
+    painter.drawPolyline(timeLine);
+
+    const PerfSample &last = m_samples.last();
+    const QString reductionText = QString("Reduction jobs %1 µs").arg(last.reductionLatency, 0, 'f', 0);
+    painter.setPen(reductionColor);
+    painter.drawText(5, lineHeight, reductionText);
+    painter.setPen(timeColor);
+    painter.drawText(15 + fontMetrics.horizontalAdvance(reductionText), lineHeight, QString("Time jobs %1 µs").arg(last.timeLatency, 0, 'f', 0));
+    painter.setPen(palette().color(QPalette::Text));
+    const QString scaleText = QString("max %1 µs").arg(maxLatency, 0, 'f', 0);
+    painter.drawText(width() - 5 - fontMetrics.horizontalAdvance(scaleText), lineHeight, scaleText);
+}
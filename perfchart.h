@@ -0,0 +1,31 @@
+#ifndef PERFCHART_H
+#define PERFCHART_H
+
+#include <QWidget>
+#include <QVector>
+#include "perfsampler.h"
+
+// Reduction and time job latencies of the running rmem over time
+class PerfChart : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit PerfChart(QWidget *parent = 0);
+
+    virtual QSize sizeHint() const override;
+
+    bool save(const QString &path) const;
+
+public slots:
+    void addSample(const PerfSample &sample);
+    void clear();
+
+protected:
+    virtual void paintEvent(QPaintEvent *) override;
+
+private:
+    // Everything since the last clear() is exported, only the most recent ones are drawn
+    QVector<PerfSample> m_samples;
+};
+
+#endif // PERFCHART_H
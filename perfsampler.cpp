@@ -0,0 +1,82 @@
+#include "perfsampler.h"
+
+#include <r_code/image.h>
+#include <r_code/image_impl.h>
+#include <r_code/object.h>
+#include <r_comp/segments.h>
+#include <r_exec/mem.h>
+#include <QTimer>
+#include <algorithm>
+
+// Polling waits at least this many times as long as the last copy of the rmem took,
+// so the sampler never takes more than a twentieth of a core
+static const int s_minIntervalPerCopyTime = 20;
+
+PerfSampler::PerfSampler(r_exec::_Mem *mem, r_comp::Metadata *metadata, qint64 samplingPeriod) : QObject(),
+    m_mem(mem),
+    m_metadata(metadata),
+    m_samplingPeriod(samplingPeriod),
+    m_timer(nullptr),
+    m_lastOid(0),
+    m_hasLastOid(false)
+{
+}
+
+void PerfSampler::start()
+{
+    // Created here, so it belongs to the sampling thread. Polling once per period is enough,
+    // anything injected in between is picked up by oid on the next one.
+    m_timer = new QTimer(this);
+    m_timer->setInterval(qMax<qint64>(m_samplingPeriod / 1000, 50));
+    connect(m_timer, &QTimer::timeout, this, &PerfSampler::sample);
+    m_timer->start();
+    m_runTime.start();
+}
+
+void PerfSampler::sample()
+{
+    QElapsedTimer copyTimer;
+    copyTimer.start();
+    r_comp::Image *image = m_mem->get_objects();
+
+    // (perf rj_ltcy d_rj_ltcy tj_ltcy d_tj_ltcy psln_thr), the latencies are in us
+    QVector<QPair<quint32, PerfSample>> samples;
+    quint32 lastOid = m_lastOid;
+    for (size_t i=0; i<image->code_segment.objects.size(); i++) {
+        r_code::SysObject *object = image->code_segment.objects[i];
+        if (m_hasLastOid && object->oid <= m_lastOid) {
+            continue;
+        }
+        lastOid = qMax(lastOid, object->oid);
+
+        if (object->code.size() < 5 || m_metadata->classes_by_opcodes[object->code[0].asOpcode()].str_opcode != "perf") {
+            continue;
+        }
+
+        PerfSample sample;
+        sample.reductionLatency = object->code[1].asFloat();
+        sample.reductionLatencyDelta = object->code[2].asFloat();
+        sample.timeLatency = object->code[3].asFloat();
+        sample.timeLatencyDelta = object->code[4].asFloat();
+        samples.append(qMakePair(object->oid, sample));
+    }
+    delete image;
+
+    m_lastOid = lastOid;
+    m_hasLastOid = true;
+
+    // Perf objects only live for a while, so backing off can miss some. The chart then has fewer
+    // points, the times stay right.
+    const qint64 basePeriod = qMax<qint64>(m_samplingPeriod / 1000, 50);
+    m_timer->setInterval(qMax(basePeriod, copyTimer.elapsed() * s_minIntervalPerCopyTime));
+
+    // They are injected once per period, in oid order, the newest one just now
+    std::sort(samples.begin(), samples.end(), [](const QPair<quint32, PerfSample> &a, const QPair<quint32, PerfSample> &b) {
+            return a.first < b.first;
+        });
+    const qint64 now = m_runTime.elapsed();
+    for (int i=0; i<samples.count(); i++) {
+        samples[i].second.time = qMax<qint64>(0, now - (samples.count() - 1 - i) * m_samplingPeriod / 1000);
+        emit sampleReady(samples[i].second);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef PERFSAMPLER_H
+#define PERFSAMPLER_H
+
+#include <QObject>
+#include <QMetaType>
+#include <QElapsedTimer>
+
+namespace r_exec {
+class _Mem;
+}
+namespace r_comp {
+class Metadata;
+}
+
+class QTimer;
+
+// One perf object from the rmem, latencies are averages over the perf sampling period
+struct PerfSample {
+    // Milliseconds since the rmem was started, from when the sample was picked up and the sampling period
+    qint64 time = 0;
+    float reductionLatency = 0;
+    float reductionLatencyDelta = 0;
+    float timeLatency = 0;
+    float timeLatencyDelta = 0;
+};
+Q_DECLARE_METATYPE(PerfSample)
+
+// Picks up the perf objects the rmem injects every perf sampling period while it is running.
+// Lives on its own thread, like LiveSampler. The rmem can only be copied as a whole, so the sampler
+// polls less often when the copy gets expensive, to keep it from skewing the latencies it reports.
+class PerfSampler : public QObject
+{
+    Q_OBJECT
+public:
+    PerfSampler(r_exec::_Mem *mem, r_comp::Metadata *metadata, qint64 samplingPeriod);
+
+public slots:
+    void start();
+    void sample();
+
+signals:
+    void sampleReady(const PerfSample &sample);
+
+private:
+    r_exec::_Mem *m_mem;
+    r_comp::Metadata *m_metadata;
+    qint64 m_samplingPeriod;
+    QTimer *m_timer;
+    QElapsedTimer m_runTime;
+
+    // Oids only grow, so everything above the last one seen is new
+    quint32 m_lastOid;
+    bool m_hasLastOid;
+};
+
+#endif // PERFSAMPLER_H
@@ -1,8 +1,11 @@
 #include "replicodehandler.h"
 
 #include "replicodehighlighter.h"
+#include "livesampler.h"
+#include "perfsampler.h"
 
 #include <sstream>
+#include <fstream>
 #include <chrono>
 #include <r_code/image.h>
 #include <r_code/image_impl.h>
@@ -17,89 +20,304 @@
 #include <QDebug>
 #include <QSet>
 #include <QFile>
+#include <QThread>
+#include <QtConcurrent>
+#include <QThreadPool>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QStandardPaths>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QDateTime>
+#include <QSettings>
+#include <QEventLoop>
+#include <QCoreApplication>
+#include <QTimer>
+#include <atomic>
+
+// Below this many objects per thread a copy of the decompiler and its name tables costs more than it saves
+static const int s_minObjectsPerShard = 256;
+
+// Bumped whenever what goes into the compile cache changes, so old entries aren't used
+static const char s_compileCacheVersion[] = "repliqode-compile-1";
+
+// Only the most recently used compiled images are kept on disk
+static const int s_maxCachedImages = 32;
+
+// Adds the file and everything it includes with !load, false if any of them can't be read
+static bool hashSourceTree(const QString &path, QCryptographicHash *hash, QSet<QString> *visited)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QString canonicalPath = QFileInfo(file).canonicalFilePath();
+    if (visited->contains(canonicalPath)) {
+        return true;
+    }
+    visited->insert(canonicalPath);
+
+    const QByteArray source = file.readAll();
+    hash->addData(path.toUtf8());
+    hash->addData(QByteArray::number(source.size()));
+    hash->addData(source);
+
+    static const QRegularExpression loadDirective("^\\s*!load\\s+(\\S+)", QRegularExpression::MultilineOption);
+    QRegularExpressionMatchIterator it = loadDirective.globalMatch(QString::fromUtf8(source));
+    while (it.hasNext()) {
+        const QString include = it.next().captured(1);
+
+        // Relative to the file including it if it is there, otherwise relative to where we run
+        QString includePath = QFileInfo(path).dir().filePath(include);
+        if (!QFile::exists(includePath)) {
+            includePath = include;
+        }
+        if (!hashSourceTree(includePath, hash, visited)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static QString compileCachePath(const QByteArray &key)
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/compiled/" + key.toHex() + ".image";
+}
+
+MemSettings MemSettings::load()
+{
+    MemSettings mem;
+    QSettings settings;
+    settings.beginGroup("mem");
+    mem.basePeriod = settings.value("baseperiod", qulonglong(mem.basePeriod)).toULongLong();
+    mem.reductionCoreCount = settings.value("reductioncores", mem.reductionCoreCount).toUInt();
+    mem.timeCoreCount = settings.value("timecores", mem.timeCoreCount).toUInt();
+    mem.modelInertiaSuccessRateThreshold = settings.value("modelinertiasuccessrate", mem.modelInertiaSuccessRateThreshold).toFloat();
+    mem.modelInertiaCountThreshold = settings.value("modelinertiacount", mem.modelInertiaCountThreshold).toUInt();
+    mem.tpxDsrThreshold = settings.value("tpxdsr", mem.tpxDsrThreshold).toFloat();
+    mem.minSimTimeHorizon = settings.value("minsimtimehorizon", qulonglong(mem.minSimTimeHorizon)).toULongLong();
+    mem.maxSimTimeHorizon = settings.value("maxsimtimehorizon", qulonglong(mem.maxSimTimeHorizon)).toULongLong();
+    mem.simTimeHorizon = settings.value("simtimehorizon", mem.simTimeHorizon).toFloat();
+    mem.tpxTimeHorizon = settings.value("tpxtimehorizon", qulonglong(mem.tpxTimeHorizon)).toULongLong();
+    mem.perfSamplingPeriod = settings.value("perfsamplingperiod", qulonglong(mem.perfSamplingPeriod)).toULongLong();
+    mem.floatTolerance = settings.value("floattolerance", mem.floatTolerance).toFloat();
+    mem.timeTolerance = settings.value("timetolerance", qulonglong(mem.timeTolerance)).toULongLong();
+    mem.primaryTimeHorizon = settings.value("primarytimehorizon", qulonglong(mem.primaryTimeHorizon)).toULongLong();
+    mem.secondaryTimeHorizon = settings.value("secondarytimehorizon", qulonglong(mem.secondaryTimeHorizon)).toULongLong();
+    mem.debug = settings.value("debug", mem.debug).toBool();
+    mem.ntfMarkerResilience = settings.value("ntfmarkerresilience", mem.ntfMarkerResilience).toUInt();
+    mem.goalPredictionSuccessResilience = settings.value("goalpredictionsuccessresilience", mem.goalPredictionSuccessResilience).toUInt();
+    mem.probeLevel = settings.value("probelevel", mem.probeLevel).toUInt();
+    mem.traceLevels = settings.value("tracelevels", mem.traceLevels).toUInt();
+
+    // Zero cores doesn't get anything done
+    mem.reductionCoreCount = qMax(1u, mem.reductionCoreCount);
+    mem.timeCoreCount = qMax(1u, mem.timeCoreCount);
+    return mem;
+}
+
+void MemSettings::autoTune(int threadCount)
+{
+    // The time cores only fire scheduled jobs, a few go a long way. One thread is left for
+    // the GUI and the decompiling, the rest do reductions.
+    timeCoreCount = qBound(1, threadCount / 8, 4);
+    reductionCoreCount = qMax(1, threadCount - int(timeCoreCount) - 1);
+}
 
 ReplicodeHandler::ReplicodeHandler(QObject *parent) : QObject(parent),
     m_mem(nullptr),
     m_image(nullptr),
-    m_metadata(nullptr)
+    m_metadata(nullptr),
+    m_initSuccess(false),
+    m_initWatcher(new QFutureWatcher<bool>(this)),
+    m_samplerThread(nullptr),
+    m_liveSampler(nullptr),
+    m_perfThread(nullptr),
+    m_decompiling(true),
+    m_perfSampling(true),
+    m_running(false),
+    m_cancelDecompile(false),
+    m_decompileWatcher(new QFutureWatcher<DecompiledImage>(this))
 {
-    initialize();
+    qRegisterMetaType<GraphDiff>();
+    qRegisterMetaType<PerfSample>();
+    connect(m_decompileWatcher, &QFutureWatcher<DecompiledImage>::finished, this, &ReplicodeHandler::onDecompiled);
+
+    // Compiling the classes takes a while, so the window can be shown in the meantime
+    connect(m_initWatcher, &QFutureWatcher<bool>::finished, this, &ReplicodeHandler::onInitialized);
+    m_initWatcher->setFuture(QtConcurrent::run([=]() {
+        QElapsedTimer timer;
+        timer.start();
+        const bool success = initialize();
+        qDebug() << "Initialized replicode in" << timer.elapsed() << "ms";
+        return success;
+    }));
 }
 
 ReplicodeHandler::~ReplicodeHandler()
 {
+    stopSampling();
+    stopPerfSampling();
+    cancelDecompile();
+    m_initWatcher->waitForFinished();
+    if (m_running) {
+        m_mem->stop();
+    }
+    delete m_mem;
     delete m_metadata;
     delete m_image;
 }
 
-void ReplicodeHandler::loadImage(QString file)
+bool ReplicodeHandler::loadImage(QString file)
 {
     if (!QFile::exists(file)) {
         emit error("Trying to open file that doesn't exist: " + file);
-        return;
+        return false;
     }
 
-    if (!m_image) {
+    if (!m_initSuccess) {
         emit error("Replicode not initialized");
-        return;
+        return false;
+    }
+
+    QString errorString;
+    QByteArray contentHash;
+    r_code::Image<r_code::ImageImpl> *image = readImage(file, &errorString, &contentHash);
+    if (!image) {
+        emit error("Unable to load " + file + ": " + errorString);
+        return false;
+    }
+
+    // Sources compiled on top of this image need different cache entries
+    if (!m_imageKey.isEmpty()) {
+        QCryptographicHash imageHash(QCryptographicHash::Sha1);
+        imageHash.addData(contentHash);
+        imageHash.addData(m_imageKey);
+        m_imageKey = imageHash.result();
     }
 
-    std::ifstream input(file.toStdString(), std::ios::binary | std::ios::in);
-    r_code::Image<r_code::ImageImpl> *image;
-    image = r_code::Image<r_code::ImageImpl>::Read(input);
+    // The decompiler might still be reading the current image
+    cancelDecompile();
+
+    // The objects are copied out, so the raw image isn't needed after this
     m_image->load(image);
+    delete image;
 
-    decompileImage(m_image);
+    decompileAsync(m_image, false);
+    return true;
 }
 
-void ReplicodeHandler::loadSource(QString file)
+r_code::Image<r_code::ImageImpl> *ReplicodeHandler::readImage(const QString &path, QString *errorString, QByteArray *contentHash)
 {
-    if (!m_image) {
+    if (contentHash) {
+        QFile file(path);
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file)) {
+            *errorString = file.errorString();
+            return nullptr;
+        }
+        *contentHash = hash.result();
+    }
+
+    std::ifstream input(path.toLocal8Bit().constData(), std::ios::binary | std::ios::in);
+    if (!input) {
+        *errorString = "Unable to open the file";
+        return nullptr;
+    }
+
+    // Read() trusts the sizes in the header, a file that is shorter than they say leaves the stream failed
+    r_code::Image<r_code::ImageImpl> *image = r_code::Image<r_code::ImageImpl>::Read(input);
+    if (!input) {
+        delete image;
+        *errorString = "Image is truncated or corrupt";
+        return nullptr;
+    }
+
+    // The map holds the offsets of the objects, which all have to be in the code segment
+    const uint32_t *codeSegment = image->getCodeSegment();
+    const qint64 codeSize = image->getCodeSegmentSize();
+    for (uint64_t i=0; i<image->getObjectCount(); i++) {
+        const qint64 offset = image->getObject(i) - codeSegment;
+        if (offset < 0 || offset >= codeSize) {
+            delete image;
+            *errorString = QString("Object %1 is outside the code segment").arg(i);
+            return nullptr;
+        }
+    }
+
+    return image;
+}
+
+bool ReplicodeHandler::loadSource(QString file)
+{
+    if (!m_initSuccess) {
         emit error("Replicode not initialized");
-        return;
+        return false;
     }
 
+    cancelDecompile();
+
+    const QByteArray key = compileKey(file);
+    if (!loadCachedImage(key)) {
+        std::string errorString;
+        if (!r_exec::Compile(file.toLocal8Bit().constData(),
+                             errorString,
+                             m_image,
+                             m_metadata,
+                             false)) {
+            // Whatever the compiler managed to add before failing isn't covered by any key
+            m_imageKey.clear();
+            emit error("Unable to compile " + file + ":\n" + QString::fromStdString(errorString));
+            return false;
+        }
+        storeCachedImage(key);
+    }
+    m_imageKey = key;
+    decompileAsync(m_image, false);
 
-    std::string errorString;
-    if (!r_exec::Compile(file.toLocal8Bit().constData(),
-                         errorString,
-                         m_image,
-                         m_metadata,
-                         false)) {
-        emit error("Unable to compile " + file + ":\n" + QString::fromStdString(errorString));
-        return;
+    return createMem();
+}
+
+bool ReplicodeHandler::createMem()
+{
+    if (!m_initSuccess) {
+        emit error("Replicode not initialized");
+        return false;
     }
-    decompileImage(m_image);
 
+    stopSampling();
+    stopPerfSampling();
     if (m_mem) {
         delete m_mem;
     }
+    m_running = false;
 
     m_mem = new r_exec::Mem<r_exec::LObject, r_exec::MemStatic>;
 
     r_code::vector<r_code::Code *> ram_objects;
     m_image->get_objects(m_mem, ram_objects);
     m_mem->metadata = m_metadata;
-    m_mem->init(50000, // base period
-                6, // reduction core count
-                2, // time core count
-                0.9, // model intertia sr thr
-                6, // model intertia cnt thr
-                0.1, // tpx dsr thr
-                0, // min sim time horizon
-                0, //max sim time horizon
-                0.3, // sim time horizon
-                500000, // tpx time horizon
-                250000, // perf sampling period
-                0.00001, // float tolerance
-                10000, // time tolerance
-                3600000, // primary thz
-                7200000, // secondary thz
-                true, // debug
-                1, // ntf mk resilience
-                1000, // goal pred success resilience
-                2, // probe level
-                0xCC // trace levels
+    m_mem->init(m_memSettings.basePeriod,
+                m_memSettings.reductionCoreCount,
+                m_memSettings.timeCoreCount,
+                m_memSettings.modelInertiaSuccessRateThreshold,
+                m_memSettings.modelInertiaCountThreshold,
+                m_memSettings.tpxDsrThreshold,
+                m_memSettings.minSimTimeHorizon,
+                m_memSettings.maxSimTimeHorizon,
+                m_memSettings.simTimeHorizon,
+                m_memSettings.tpxTimeHorizon,
+                m_memSettings.perfSamplingPeriod,
+                m_memSettings.floatTolerance,
+                m_memSettings.timeTolerance,
+                m_memSettings.primaryTimeHorizon,
+                m_memSettings.secondaryTimeHorizon,
+                m_memSettings.debug,
+                m_memSettings.ntfMarkerResilience,
+                m_memSettings.goalPredictionSuccessResilience,
+                m_memSettings.probeLevel,
+                m_memSettings.traceLevels
                 );
 
     uint64_t stdin_oid;
@@ -122,8 +340,81 @@ void ReplicodeHandler::loadSource(QString file)
 
     if (!m_mem->load(ram_objects.as_std(), stdin_oid, stdout_oid, self_oid)) {
         emit error("Memory failed to load objects");
-        return;
+        return false;
+    }
+    return true;
+}
+
+QMap<QString, int> ReplicodeHandler::objectCounts() const
+{
+    QMap<QString, int> counts;
+    if (!m_mem) {
+        return counts;
+    }
+
+    r_comp::Image *image = m_mem->get_objects();
+    for (size_t i=0; i<image->code_segment.objects.size(); i++) {
+        r_code::SysObject *object = image->code_segment.objects[i];
+        counts[QString::fromStdString(m_metadata->classes_by_opcodes[object->code[0].asOpcode()].str_opcode)]++;
+    }
+    delete image;
+    return counts;
+}
+
+bool ReplicodeHandler::writeCurrentImage(const QString &path) const
+{
+    if (!m_mem) {
+        return false;
+    }
+
+    r_comp::Image *image = m_mem->get_objects();
+    image->object_names.symbols = m_image->object_names.symbols;
+    const bool success = writeImage(image, path);
+    delete image;
+    return success;
+}
+
+bool ReplicodeHandler::run(int duration, RunStatistics *statistics)
+{
+    *statistics = RunStatistics();
+    for (int count : objectCounts()) {
+        statistics->objectsBefore += count;
+    }
+
+    double reductionLatency = 0;
+    double timeLatency = 0;
+    const QMetaObject::Connection perfConnection = connect(this, &ReplicodeHandler::perfSample, [&](const PerfSample &sample) {
+        statistics->perfSamples++;
+        reductionLatency += sample.reductionLatency;
+        timeLatency += sample.timeLatency;
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    if (!start()) {
+        disconnect(perfConnection);
+        emit error("Unable to start the rmem");
+        return false;
     }
+    QEventLoop eventLoop;
+    QTimer::singleShot(duration, &eventLoop, &QEventLoop::quit);
+    eventLoop.exec();
+    stop();
+    statistics->seconds = timer.nsecsElapsed() / 1000000000.;
+
+    // Anything still queued from the perf sampler
+    QCoreApplication::processEvents();
+    disconnect(perfConnection);
+
+    statistics->classCounts = objectCounts();
+    for (int count : statistics->classCounts) {
+        statistics->objectsAfter += count;
+    }
+    if (statistics->perfSamples) {
+        statistics->meanReductionLatency = reductionLatency / statistics->perfSamples;
+        statistics->meanTimeLatency = timeLatency / statistics->perfSamples;
+    }
+    return true;
 }
 
 bool ReplicodeHandler::start()
@@ -133,50 +424,365 @@ bool ReplicodeHandler::start()
     }
 
     uint64_t startTime = m_mem->start();
+    if (startTime == 0) {
+        return false;
+    }
+
+    m_running = true;
+    if (m_perfSampling) {
+        startPerfSampling();
+    }
+    return true;
+}
 
-    return (startTime != 0);
+void ReplicodeHandler::startPerfSampling()
+{
+    stopPerfSampling();
+
+    // Own thread, so a slow get_objects() doesn't hold up the live graph updates
+    m_perfThread = new QThread(this);
+    PerfSampler *sampler = new PerfSampler(m_mem, m_metadata, m_memSettings.perfSamplingPeriod);
+    sampler->moveToThread(m_perfThread);
+    connect(m_perfThread, &QThread::started, sampler, &PerfSampler::start);
+    connect(m_perfThread, &QThread::finished, sampler, &QObject::deleteLater);
+    connect(sampler, &PerfSampler::sampleReady, this, &ReplicodeHandler::perfSample);
+    m_perfThread->start();
 }
 
-void ReplicodeHandler::decompileImage(r_comp::Image *image)
+void ReplicodeHandler::stopPerfSampling()
 {
-    m_nodes.clear();
-    m_edges.clear();
+    if (!m_perfThread) {
+        return;
+    }
 
+    m_perfThread->quit();
+    m_perfThread->wait();
+    delete m_perfThread;
+    m_perfThread = nullptr;
+}
+
+QByteArray ReplicodeHandler::compileKey(const QString &file) const
+{
+    // Without knowing what the source is compiled on top of there's nothing to key on
+    if (m_imageKey.isEmpty()) {
+        return QByteArray();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(s_compileCacheVersion);
+    hash.addData(m_imageKey);
+
+    // The metadata isn't compiled, it is already covered by the classes in m_imageKey
+    hash.addData("compile_metadata=false");
+
+    QSet<QString> visited;
+    if (!hashSourceTree(file, &hash, &visited)) {
+        return QByteArray();
+    }
+    return hash.result();
+}
+
+bool ReplicodeHandler::loadCachedImage(const QByteArray &key)
+{
+    if (key.isEmpty()) {
+        return false;
+    }
+
+    const QString path = compileCachePath(key);
+    if (!QFile::exists(path)) {
+        return false;
+    }
+
+    // A broken entry is just compiled again and overwritten
+    QString errorString;
+    r_code::Image<r_code::ImageImpl> *cached = readImage(path, &errorString);
+    if (!cached) {
+        qWarning() << "Ignoring broken compile cache entry" << path << errorString;
+        return false;
+    }
+
+    // The cached image holds everything m_image had before compiling as well, so it replaces it
+    r_comp::Image *image = new r_comp::Image;
+    image->load(cached);
+    delete cached;
+    delete m_image;
+    m_image = image;
+
+    // Marks it as recently used for the pruning in storeCachedImage()
+    QFile(path).setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    return true;
+}
+
+void ReplicodeHandler::storeCachedImage(const QByteArray &key)
+{
+    if (key.isEmpty()) {
+        return;
+    }
+
+    QDir directory(QFileInfo(compileCachePath(key)).path());
+    if (!directory.mkpath(".")) {
+        qWarning() << "Unable to create compile cache in" << directory.path();
+        return;
+    }
+
+    const QString path = compileCachePath(key);
+    if (!writeImage(m_image, path)) {
+        qWarning() << "Unable to write compile cache entry" << path;
+        return;
+    }
+
+    const QFileInfoList entries = directory.entryInfoList(QStringList() << "*.image", QDir::Files, QDir::Time);
+    for (int i=s_maxCachedImages; i<entries.count(); i++) {
+        QFile::remove(entries[i].filePath());
+    }
+}
+
+bool ReplicodeHandler::writeImage(r_comp::Image *image, const QString &path)
+{
+    // Written next to it and renamed, so a crash never leaves a half written image
+    const QString temporaryPath = path + ".tmp";
+    r_code::Image<r_code::ImageImpl> *serialized = image->serialize<r_code::Image<r_code::ImageImpl>>();
+    bool success;
+    {
+        std::ofstream output(temporaryPath.toStdString(), std::ios::binary | std::ios::out | std::ios::trunc);
+        r_code::Image<r_code::ImageImpl>::Write(serialized, output);
+        output.close();
+        success = output.good();
+    }
+    delete serialized;
+
+    QFile::remove(path);
+    if (!success || !QFile::rename(temporaryPath, path)) {
+        QFile::remove(temporaryPath);
+        return false;
+    }
+    return true;
+}
+
+void ReplicodeHandler::decompileAsync(r_comp::Image *image, bool deleteImage)
+{
+    cancelDecompile();
+    if (!m_decompiling) {
+        if (deleteImage) {
+            delete image;
+        }
+        return;
+    }
+    m_cancelDecompile = false;
+
+    m_decompileWatcher->setFuture(QtConcurrent::run([=]() {
+        DecompiledImage result = decompileImage(image, deleteImage);
+        if (deleteImage) {
+            delete image;
+        }
+        return result;
+    }));
+}
+
+void ReplicodeHandler::cancelDecompile()
+{
+    // Has to wait, the decompiler reads the image and the cache that the caller is about to change.
+    // The flag is checked between objects and between the passes, so this only blocks for as long
+    // as a single reference pass, which the decompiler can't be interrupted in.
+    m_cancelDecompile = true;
+    m_decompileWatcher->waitForFinished();
+}
+
+bool ReplicodeHandler::waitForInitialized()
+{
+    m_initWatcher->waitForFinished();
+    m_initSuccess = m_initWatcher->result();
+    return m_initSuccess;
+}
+
+void ReplicodeHandler::onInitialized()
+{
+    m_initSuccess = m_initWatcher->result();
+    if (!m_initSuccess) {
+        emit error("Unable to initialize replicode from user.classes.replicode");
+    }
+    emit initialized(m_initSuccess);
+}
+
+void ReplicodeHandler::onDecompiled()
+{
+    DecompiledImage result = m_decompileWatcher->result();
+    if (result.canceled) {
+        emit decompileCanceled();
+        return;
+    }
+
+    // Swapped in together, and handed to the widget together in one setGraph()
+    m_nodes.swap(result.nodes);
+    m_edges.swap(result.edges);
+    m_sources.swap(result.sources);
+    m_oids.swap(result.oids);
+    emit graphLoaded();
+}
+
+// Covers everything that ends up in the decompiled source: the code and views of the object,
+// its name and the names of the objects it refers to
+static QByteArray objectHash(r_comp::Image *image, uint64_t index, const QVector<QByteArray> &names)
+{
+    const r_code::SysObject *object = image->code_segment.objects[index];
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    QVector<quint32> words;
+    const auto addWords = [&]() {
+        hash.addData(reinterpret_cast<const char*>(words.constData()), words.count() * sizeof(quint32));
+        words.clear();
+    };
+    const auto addName = [&](uint64_t objectIndex) {
+        const QByteArray name = names.value(objectIndex);
+        words.append(name.size());
+        addWords();
+        hash.addData(name);
+    };
+
+    addName(index);
+    words.append(object->code.size());
+    for (size_t i=0; i<object->code.size(); i++) {
+        words.append(object->code[i].atom);
+    }
+    words.append(object->references.size());
+    addWords();
+    for (size_t i=0; i<object->references.size(); i++) {
+        addName(object->references[i]);
+    }
+
+    words.append(object->views.size());
+    for (size_t i=0; i<object->views.size(); i++) {
+        const r_code::SysView *view = object->views[i];
+        words.append(view->code.size());
+        for (size_t j=0; j<view->code.size(); j++) {
+            words.append(view->code[j].atom);
+        }
+        words.append(view->references.size());
+        addWords();
+        for (size_t j=0; j<view->references.size(); j++) {
+            addName(view->references[j]);
+        }
+    }
+    addWords();
+
+    return hash.result();
+}
+
+DecompiledImage ReplicodeHandler::decompileImage(r_comp::Image *image, bool hasOids)
+{
+    DecompiledImage result;
+
+    const uint64_t objectCount = image->code_segment.objects.size();
+    result.sources.resize(objectCount);
+
+    // The rmem gives the objects of a loaded image their index as oid
+    result.oids.resize(objectCount);
+    for (uint64_t i=0; i<objectCount; i++) {
+        result.oids[i] = hasOids ? image->code_segment.objects[i]->oid : i;
+    }
+
+    // The reference pass names every object, the names are needed for the hashes
     r_comp::Decompiler decompiler;
     decompiler.init(m_metadata);
+    decompiler.decompile_references(image);
+    if (m_cancelDecompile) {
+        result.canceled = true;
+        return result;
+    }
+    QVector<QByteArray> names(objectCount);
+    for (uint64_t i=0; i<objectCount; i++) {
+        names[i] = QByteArray::fromStdString(decompiler.get_object_name(i));
+    }
 
-    uint64_t objectCount = decompiler.decompile_references(image);
+    // Objects that hash the same as one in the previous image get their type and source from the cache,
+    // the rest is decompiled. Types are looked up here, so the metadata isn't touched by the threads.
+    QVector<QString> types(objectCount);
+    QVector<QByteArray> hashes(objectCount);
+    QVector<uint64_t> changed;
+    for (uint64_t i=0; i<objectCount; i++) {
+        if (m_cancelDecompile) {
+            result.canceled = true;
+            return result;
+        }
+        hashes[i] = objectHash(image, i, names);
+        QHash<QByteArray, DecompiledObject>::const_iterator cached = m_decompileCache.constFind(hashes[i]);
+        if (cached != m_decompileCache.constEnd()) {
+            types[i] = cached->type;
+            result.sources[i] = cached->source;
+            continue;
+        }
+        types[i] = QString::fromStdString(m_metadata->classes_by_opcodes[image->code_segment.objects[i]->code[0].asOpcode()].str_opcode);
+        changed.append(i);
+    }
 
-    for (size_t i=0; i<objectCount; i++) {
-        std::ostringstream source;
-        source.precision(2);
-        decompiler.decompile_object(i, &source, 0);
-        QString nodeName = QString::fromStdString(decompiler.get_object_name(i));
-
-        QString type = QString::fromStdString(m_metadata->classes_by_opcodes[image->code_segment.objects[i]->code[0].asOpcode()].str_opcode);
-
-        QString group;
-        if (type.startsWith("mk.")) {
-            group = "passive";
-        } else if (type.startsWith("ont")) {
-            group = "passive";
-        } else if (type.startsWith("ent")) {
-            group = "passive";
-        } else if (type.contains("fact")) {
-            group = "passive";
-        } else if (type.contains("mdl")) {
-            group = "active";
-        } else if (type.startsWith("cst")) {
-            group = "passive";
-        } else if (type.contains("pgm")) {
-            group = "active";
-        } else if (type.contains("grp")) {
-            group = "groups";
-        } else if (type.contains("perf")) {
-            group = "passive";
-        } else if (type.contains("cmd")) {
-            group = "passive";
-        } else {
+    // Once the references are known every object decompiles on its own, so contiguous shards of them
+    // go to separate threads. Results are stored by index, so they are the same as when decompiling serially.
+    const int changedCount = changed.count();
+    const int shardCount = qBound(1, changedCount / s_minObjectsPerShard, QThreadPool::globalInstance()->maxThreadCount());
+    const int shardSize = (changedCount + shardCount - 1) / shardCount;
+    QVector<QPair<int, int>> shards;
+    for (int begin = 0; begin < changedCount; begin += shardSize) {
+        shards.append(qMakePair(begin, qMin(begin + shardSize, changedCount)));
+    }
+
+    // The decompiler keeps state while writing an object, so every other shard gets a copy of it. Only copied
+    // before it writes anything, the copies then share nothing but the names and references from the one pass.
+    std::vector<r_comp::Decompiler> shardDecompilers(qMax(shards.count() - 1, 0), decompiler);
+
+    // Detach before handing out the pointer to the worker threads
+    QByteArray *sourcesData = result.sources.data();
+
+    // Often enough for a smooth progress bar, without flooding the event loop
+    const int progressStep = qMax(changedCount / 100, 1);
+    std::atomic<int> decompiledCount(0);
+
+    QtConcurrent::blockingMap(shards, [&](QPair<int, int> &shard) {
+        const int shardIndex = shard.first / shardSize;
+        r_comp::Decompiler *objectDecompiler = shardIndex == 0 ? &decompiler : &shardDecompilers[shardIndex - 1];
+
+        for (int j = shard.first; j < shard.second; j++) {
+            if (m_cancelDecompile) {
+                return;
+            }
+
+            // Documents are only created and highlighted when the source is shown
+            const uint64_t i = changed[j];
+            if (!classGroup(types[i]).isEmpty()) {
+                std::ostringstream source;
+                source.precision(2);
+                objectDecompiler->decompile_object(i, &source, 0);
+                sourcesData[i] = QByteArray::fromStdString(source.str());
+            }
+
+            const int done = ++decompiledCount;
+            if (done % progressStep == 0) {
+                emit decompileProgress(done, changedCount);
+            }
+        }
+    });
+
+    if (m_cancelDecompile) {
+        result.canceled = true;
+        return result;
+    }
+
+    // Only what is in this image is kept, so the cache doesn't grow across runs
+    QHash<QByteArray, DecompiledObject> cache;
+    cache.reserve(objectCount);
+    for (uint64_t i=0; i<objectCount; i++) {
+        cache.insert(hashes[i], { types[i], result.sources[i] });
+    }
+    m_decompileCache.swap(cache);
+
+    // Node ids are dense, objects we don't categorize don't get one
+    QVector<int> nodeIds(objectCount, -1);
+
+    for (uint64_t i=0; i<objectCount; i++) {
+        const QString nodeName = QString::fromUtf8(names[i]);
+        const QString &type = types[i];
+
+        const QString group = classGroup(type);
+        if (group.isEmpty()) {
             qDebug() << "Uncategorized object class" << nodeName << type;
             continue;
         }
@@ -190,29 +796,146 @@ void ReplicodeHandler::decompileImage(r_comp::Image *image)
             node.displayName += " (" + type + ')';
         }
 
-        QTextDocument *sourceDoc = new QTextDocument(QString::fromStdString(source.str()));
-        new ReplicodeHighlighter(sourceDoc);
-        node.sourcecode = std::shared_ptr<QTextDocument>(sourceDoc);
-        m_nodes.insert(nodeName, node);
+        node.objectIndex = i;
+
+        nodeIds[i] = result.nodes.count();
+        result.nodes.append(node);
+    }
+    emit decompileProgress(changedCount, changedCount);
+
+    // References can point forward, so edges are resolved once every object has its id
+    for (size_t i=0; i<objectCount; i++) {
+        const int source = nodeIds[i];
+        if (source == -1) {
+            continue;
+        }
 
         r_code::SysObject *imageObject = image->code_segment.objects[i];
         for (size_t j=0; j<imageObject->views.size(); j++) {
             r_code::SysView *view = imageObject->views[j];
             for (size_t k=0; k<view->references.size(); k++) {
+                const int target = nodeIds.value(view->references[k], -1);
+                if (target == -1) {
+                    continue;
+                }
                 Edge edge;
-                edge.source = nodeName;
-                edge.target = QString::fromStdString(decompiler.get_object_name(view->references[k]));
+                edge.source = source;
+                edge.target = target;
                 edge.isView = true;
-                m_edges.append(edge);
+                result.edges.append(edge);
             }
         }
         for (size_t j=0; j<imageObject->references.size(); j++) {
+            const int target = nodeIds.value(imageObject->references[j], -1);
+            if (target == -1) {
+                continue;
+            }
             Edge edge;
-            edge.source = nodeName;
-            edge.target = QString::fromStdString(decompiler.get_object_name(imageObject->references[j]));
-            m_edges.append(edge);
+            edge.source = source;
+            edge.target = target;
+            result.edges.append(edge);
         }
     }
+
+    return result;
+}
+
+QString ReplicodeHandler::classGroup(const QString &type)
+{
+    if (type.startsWith("mk.")) {
+        return "passive";
+    } else if (type.startsWith("ont")) {
+        return "passive";
+    } else if (type.startsWith("ent")) {
+        return "passive";
+    } else if (type.contains("fact")) {
+        return "passive";
+    } else if (type.contains("mdl")) {
+        return "active";
+    } else if (type.startsWith("cst")) {
+        return "passive";
+    } else if (type.contains("pgm")) {
+        return "active";
+    } else if (type.contains("grp")) {
+        return "groups";
+    } else if (type.contains("perf")) {
+        return "passive";
+    } else if (type.contains("cmd")) {
+        return "passive";
+    } else {
+        return QString();
+    }
+}
+
+void ReplicodeHandler::startSampling(int interval)
+{
+    stopSampling();
+    if (!m_mem) {
+        return;
+    }
+
+    QHash<quint32, QString> names;
+    for (const std::pair<const uint32_t, std::string> &symbol : m_image->object_names.symbols) {
+        names.insert(symbol.first, QString::fromStdString(symbol.second));
+    }
+
+    // Objects that were decompiled keep their name and object index, so their source can still be shown
+    QHash<quint32, Node> decompiledNodes;
+    for (const Node &node : m_nodes) {
+        decompiledNodes.insert(m_oids.value(node.objectIndex), node);
+    }
+
+    // Sampling and diffing happen on their own thread, only the diffs come back here
+    m_samplerThread = new QThread(this);
+    m_liveSampler = new LiveSampler(m_mem, m_metadata, names, decompiledNodes);
+    LiveSampler *sampler = m_liveSampler;
+    sampler->moveToThread(m_samplerThread);
+    connect(m_samplerThread, &QThread::started, sampler, [=]() {
+            sampler->start(interval);
+        });
+    connect(m_samplerThread, &QThread::finished, sampler, &QObject::deleteLater);
+    connect(sampler, &LiveSampler::diffReady, this, [=](const GraphDiff &diff) {
+            // Diffs still queued after sampling stopped are out of date
+            if (m_samplerThread) {
+                emit graphChanged(diff);
+            }
+        });
+    m_samplerThread->start();
+}
+
+void ReplicodeHandler::stopSampling()
+{
+    if (!m_samplerThread) {
+        return;
+    }
+
+    // Waits for a sample in progress, so the rmem can be stopped or deleted afterwards
+    m_samplerThread->quit();
+    m_samplerThread->wait();
+    delete m_samplerThread;
+    m_samplerThread = nullptr;
+    m_liveSampler = nullptr;
+}
+
+void ReplicodeHandler::requestResync()
+{
+    if (!m_liveSampler) {
+        return;
+    }
+
+    // Lives on the sampling thread, so this is picked up before its next sample
+    QMetaObject::invokeMethod(m_liveSampler, "resync", Qt::QueuedConnection);
+}
+
+QTextDocument *ReplicodeHandler::createSourceDocument(const QVector<QByteArray> &sources, int objectIndex)
+{
+    if (objectIndex < 0 || objectIndex >= sources.count()) {
+        return nullptr;
+    }
+
+    QTextDocument *document = new QTextDocument(QString::fromUtf8(sources[objectIndex]));
+    new ReplicodeHighlighter(document);
+    return document;
 }
 
 bool testCallback(uint64_t time, bool suspended, const char *msg, uint8_t object_count, r_code::Code **objects)
@@ -233,17 +956,24 @@ bool ReplicodeHandler::initialize()
     m_metadata = new r_comp::Metadata;
     m_image = new r_comp::Image;
 
-    return r_exec::Init(nullptr,
-                        []() -> uint64_t {
-                            using namespace std::chrono;
-                            return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
-                        },
-                        "user.classes.replicode",
-                        m_image,
-                        m_metadata
-                        );
+    // The classes decide both the metadata and the objects the image starts out with
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QSet<QString> visited;
+    hash.addData(s_compileCacheVersion);
+    m_imageKey = hashSourceTree("user.classes.replicode", &hash, &visited) ? hash.result() : QByteArray();
+
+    const bool success = r_exec::Init(nullptr,
+                                      []() -> uint64_t {
+                                          using namespace std::chrono;
+                                          return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+                                      },
+                                      "user.classes.replicode",
+                                      m_image,
+                                      m_metadata
+                                      );
 
     r_exec::Callbacks::Register(std::string("test"), testCallback);
+    return success;
 }
 
 void ReplicodeHandler::stop()
@@ -251,11 +981,17 @@ void ReplicodeHandler::stop()
     if (!m_mem) {
         return;
     }
+    stopSampling();
+    stopPerfSampling();
     m_mem->stop();
+    m_running = false;
 
+    // Copying the rmem is only worth it for the graph
+    if (!m_decompiling) {
+        return;
+    }
     r_comp::Image *image = m_mem->get_objects();
     // Ensure that we get proper names
     image->object_names.symbols = m_image->object_names.symbols;
-    decompileImage(image);
-    delete image;
+    decompileAsync(image, true);
 }
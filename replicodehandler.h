@@ -3,8 +3,18 @@
 
 #include <QObject>
 #include <QTextDocument>
-#include "hivewidget.h"
+#include <QFutureWatcher>
+#include <QHash>
+#include <QMap>
+#include <atomic>
+#include <cstdint>
+#include "hivegraph.h"
+#include "perfsampler.h"
 
+namespace r_code {
+class ImageImpl;
+template<class I> class Image;
+}
 namespace r_exec {
 class _Mem;
 }
@@ -13,36 +23,201 @@ class Image;
 class Metadata;
 }
 
+class QThread;
+class LiveSampler;
+
+// Everything decompileImage() produces, swapped in as a whole when it is done
+struct DecompiledImage {
+    QVector<Node> nodes;
+    QVector<Edge> edges;
+    QVector<QByteArray> sources;
+
+    // Oid of every object in the rmem, for matching up the live samples with the nodes
+    QVector<quint32> oids;
+    bool canceled = false;
+};
+
+// Cached by the hash of the object, see objectHash()
+struct DecompiledObject {
+    QString type;
+    QByteArray source;
+};
+
+// Passed to _Mem::init() when a source is loaded, the defaults are what worked for the examples
+struct MemSettings {
+    uint64_t basePeriod = 50000;
+    uint32_t reductionCoreCount = 6;
+    uint32_t timeCoreCount = 2;
+    float modelInertiaSuccessRateThreshold = 0.9;
+    uint32_t modelInertiaCountThreshold = 6;
+    float tpxDsrThreshold = 0.1;
+    uint64_t minSimTimeHorizon = 0;
+    uint64_t maxSimTimeHorizon = 0;
+    float simTimeHorizon = 0.3;
+    uint64_t tpxTimeHorizon = 500000;
+    uint64_t perfSamplingPeriod = 250000;
+    float floatTolerance = 0.00001;
+    uint64_t timeTolerance = 10000;
+    uint64_t primaryTimeHorizon = 3600000;
+    uint64_t secondaryTimeHorizon = 7200000;
+    bool debug = true;
+    uint32_t ntfMarkerResilience = 1;
+    uint32_t goalPredictionSuccessResilience = 1000;
+    uint32_t probeLevel = 2;
+    uint32_t traceLevels = 0xCC;
+
+    // Overridden by whatever is in the "mem" group of the settings
+    static MemSettings load();
+
+    // Picks the core counts for a machine with this many hardware threads
+    void autoTune(int threadCount);
+};
+
+// What ReplicodeHandler::run() measured
+struct RunStatistics {
+    double seconds = 0;
+    int objectsBefore = 0;
+    int objectsAfter = 0;
+
+    // Objects in the rmem after the run
+    QMap<QString, int> classCounts;
+
+    // Averages of the perf objects, the rmem doesn't count reductions itself
+    int perfSamples = 0;
+    double meanReductionLatency = 0;
+    double meanTimeLatency = 0;
+};
+
 class ReplicodeHandler : public QObject
 {
     Q_OBJECT
 public:
+    // Starts initializing from user.classes.replicode in the working directory right away, see initialized()
     explicit ReplicodeHandler(QObject *parent = 0);
     ~ReplicodeHandler();
 
-    const QMap<QString, Node> &getNodes() { return m_nodes; }
-    const QList<Edge> &getEdges() { return m_edges; }
+    const QVector<Node> &getNodes() { return m_nodes; }
+    const QVector<Edge> &getEdges() { return m_edges; }
+    const QVector<QByteArray> &getSources() { return m_sources; }
+
+    // Highlighted source of an object from getSources(), null if there is no such object
+    static QTextDocument *createSourceDocument(const QVector<QByteArray> &sources, int objectIndex);
+
+    // Group of the objects of a class in the hive plot, empty for classes that aren't shown
+    static QString classGroup(const QString &type);
+
+    // Used from the next loadSource() on
+    void setMemSettings(const MemSettings &settings) { m_memSettings = settings; }
+
+    // Blocks until the background initialization is done, for when there's no event loop running
+    bool waitForInitialized();
+
+    // False if it couldn't be loaded, error() has been emitted then
+    bool loadImage(QString file);
+    bool loadSource(QString file);
+
+    // Sets up a new rmem with the objects of the current image, loadSource() does this itself
+    bool createMem();
+
+    // Written atomically, false if it couldn't be written
+    static bool writeImage(r_comp::Image *image, const QString &path);
+
+    // The objects in the rmem, with the names from the loaded image, like what stop() decompiles
+    bool writeCurrentImage(const QString &path) const;
+
+    // Objects in the rmem right now, by class, empty if there is no rmem
+    QMap<QString, int> objectCounts() const;
+
+    // Starts the rmem, runs an event loop of its own for duration milliseconds so the perf samples
+    // come in, and stops it again. For running without a window, false if it couldn't be started.
+    bool run(int duration, RunStatistics *statistics);
+
+    // Without a graph to show there's no point in decompiling what is loaded or stopped
+    void setDecompiling(bool decompiling) { m_decompiling = decompiling; }
+
+    // Picking up the perf objects copies the rmem now and then, so it can be turned off when nothing
+    // needs perfSample(). Used from the next start() on.
+    void setPerfSampling(bool perfSampling) { m_perfSampling = perfSampling; }
 
-    void loadImage(QString file);
-    void loadSource(QString file);
     void stop();
 
 public slots:
     bool start();
 
+    // Samples the running rmem every interval milliseconds and sends what changed through graphChanged()
+    void startSampling(int interval);
+    void stopSampling();
+
+    // For when a diff couldn't be applied, the next one sent through graphChanged() is a reset
+    void requestResync();
+
 signals:
     void error(QString error);
+    void graphChanged(const GraphDiff &diff);
+
+    // Emitted for every perf object the rmem injects while it is running
+    void perfSample(const PerfSample &sample);
+
+    // Initializing runs on a worker thread, nothing can be loaded before this is emitted
+    void initialized(bool success);
+
+    // Decompiling runs on a worker thread, graphLoaded() is emitted once the new nodes and edges are in place
+    void decompileProgress(int done, int total);
+    void graphLoaded();
+
+    // Instead of graphLoaded() when decompiling was cancelled and nothing else was started in its place
+    void decompileCanceled();
+
+private slots:
+    void onInitialized();
+    void onDecompiled();
 
 private:
-    void decompileImage(r_comp::Image *image);
+    // Times decompileImage() on its own
+    friend class DecompileBenchmark;
+
+    // Reads the raw image and checks that it is complete and its objects are in the code segment,
+    // null and errorString set if it is broken. contentHash, if given, is set to the hash of the file.
+    static r_code::Image<r_code::ImageImpl> *readImage(const QString &path, QString *errorString, QByteArray *contentHash = nullptr);
+
+    // Compiled images are cached on disk by compileKey(), which covers everything the result depends on
+    QByteArray compileKey(const QString &file) const;
+    bool loadCachedImage(const QByteArray &key);
+    void storeCachedImage(const QByteArray &key);
+
+    // Only copies of the rmem are deleted, and only those already carry the oids of their objects
+    void decompileAsync(r_comp::Image *image, bool deleteImage);
+    void cancelDecompile();
+    DecompiledImage decompileImage(r_comp::Image *image, bool hasOids = false);
     bool initialize();
+    void startPerfSampling();
+    void stopPerfSampling();
 
     r_exec::_Mem *m_mem;
+    MemSettings m_memSettings;
     r_comp::Image *m_image;
     r_comp::Metadata *m_metadata;
-    QMap<QString, Node> m_nodes;
-    QList<Edge> m_edges;
+    QVector<Node> m_nodes;
+    QVector<Edge> m_edges;
+    QVector<QByteArray> m_sources;
+    QVector<quint32> m_oids;
     bool m_initSuccess;
+    QFutureWatcher<bool> *m_initWatcher;
+
+    // Hash of everything that went into m_image so far, empty if that isn't known
+    QByteArray m_imageKey;
+
+    QThread *m_samplerThread;
+    LiveSampler *m_liveSampler;
+    QThread *m_perfThread;
+    bool m_decompiling;
+    bool m_perfSampling;
+    bool m_running;
+    std::atomic<bool> m_cancelDecompile;
+    QFutureWatcher<DecompiledImage> *m_decompileWatcher;
+
+    // What the objects of the last decompiled image decompiled to, only touched by decompileImage()
+    QHash<QByteArray, DecompiledObject> m_decompileCache;
 };
 
 #endif // REPLICODEHANDLER_H
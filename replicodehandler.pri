@@ -0,0 +1,25 @@
+# ReplicodeHandler and everything it needs, shared by the application and the command line tools
+
+QT       += core gui concurrent
+
+LIBS +=  -lr_code -lr_comp -lr_exec
+
+exists($$PWD/config.pri) {
+    include($$PWD/config.pri)
+}
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/replicodehandler.cpp \
+    $$PWD/replicodehighlighter.cpp \
+    $$PWD/livesampler.cpp \
+    $$PWD/perfsampler.cpp \
+    $$PWD/hivegraph.cpp
+
+HEADERS  += \
+    $$PWD/replicodehandler.h \
+    $$PWD/replicodehighlighter.h \
+    $$PWD/livesampler.h \
+    $$PWD/perfsampler.h \
+    $$PWD/hivegraph.h
@@ -4,13 +4,9 @@
 #
 #-------------------------------------------------
 
-QT       += core gui widgets
+QT       += core gui widgets concurrent
 
-LIBS +=  -lr_code -lr_comp -lr_exec
-
-exists(config.pri) {
-    include(config.pri)
-}
+include(replicodehandler.pri)
 
 TARGET = repliqode
 TEMPLATE = app
@@ -19,17 +15,17 @@ CONFIG += c++11
 
 SOURCES += main.cpp \
     hivewidget.cpp \
-    replicodehandler.cpp \
     window.cpp \
-    replicodehighlighter.cpp \
-    streamredirector.cpp
+    streamredirector.cpp \
+    framestats.cpp \
+    perfchart.cpp
 
 HEADERS  += \
     hivewidget.h \
-    replicodehandler.h \
     window.h \
-    replicodehighlighter.h \
-    streamredirector.h
+    streamredirector.h \
+    framestats.h \
+    perfchart.h
 
 # Copy in some examples
 copydata.commands = $(COPY) \
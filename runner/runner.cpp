@@ -0,0 +1,104 @@
+#include "replicodehandler.h"
+#include "toolcommon.h"
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QFile>
+#include <QTextStream>
+#include <QJsonObject>
+
+int main(int argc, char *argv[])
+{
+    useOffscreenPlatform();
+    QGuiApplication application(argc, argv);
+
+    // Same settings and compile cache as the application
+    application.setApplicationName("repliqode");
+    application.setOrganizationDomain("nous.ai");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs a replicode source or image for a while without the GUI, "
+                                     "and prints statistics about the run as JSON");
+    parser.addHelpOption();
+    QCommandLineOption sourceOption("source", "Source file to compile and run", "file");
+    QCommandLineOption imageOption("image", "Image to run", "file");
+    QCommandLineOption durationOption("duration", "How long to run, in milliseconds", "ms", "10000");
+    QCommandLineOption autoTuneOption("auto-tune", "Pick the core counts from the hardware instead of the settings");
+    QCommandLineOption reductionCoresOption("reduction-cores", "Number of reduction cores, overrides the settings", "count");
+    QCommandLineOption timeCoresOption("time-cores", "Number of time cores, overrides the settings", "count");
+    QCommandLineOption noPerfOption("no-perf", "Don't pick up the perf objects, so the runs aren't slowed down by copying the rmem for them");
+    QCommandLineOption imageOutputOption("write-image", "Write the objects in the rmem after the run to this image", "file");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Write the statistics to this file instead of stdout", "file");
+    parser.addOptions({sourceOption, imageOption, durationOption, autoTuneOption, reductionCoresOption, timeCoresOption, noPerfOption, imageOutputOption, outputOption});
+    parser.process(application);
+
+    if (parser.isSet(sourceOption) == parser.isSet(imageOption)) {
+        QTextStream(stderr) << "Either a source or an image to run is needed\n";
+        return 1;
+    }
+    const QString inputFile = parser.isSet(sourceOption) ? parser.value(sourceOption) : parser.value(imageOption);
+    if (!QFile::exists(inputFile)) {
+        QTextStream(stderr) << inputFile << " doesn't exist\n";
+        return 1;
+    }
+
+    MemSettings settings = MemSettings::load();
+    if (parser.isSet(autoTuneOption)) {
+        settings.autoTune(QThread::idealThreadCount());
+    }
+    if (parser.isSet(reductionCoresOption)) {
+        settings.reductionCoreCount = qMax(1, parser.value(reductionCoresOption).toInt());
+    }
+    if (parser.isSet(timeCoresOption)) {
+        settings.timeCoreCount = qMax(1, parser.value(timeCoresOption).toInt());
+    }
+
+    ReplicodeHandler handler;
+    QString errorString;
+    QObject::connect(&handler, &ReplicodeHandler::error, [&](const QString &error) { errorString = error; });
+    handler.setMemSettings(settings);
+    handler.setDecompiling(false);
+    handler.setPerfSampling(!parser.isSet(noPerfOption));
+    if (!handler.waitForInitialized()) {
+        QTextStream(stderr) << "Unable to initialize replicode\n";
+        return 1;
+    }
+    const bool loaded = parser.isSet(sourceOption) ? handler.loadSource(inputFile) : (handler.loadImage(inputFile) && handler.createMem());
+    if (!loaded) {
+        QTextStream(stderr) << "Unable to load " << inputFile << ": " << errorString << "\n";
+        return 1;
+    }
+
+    RunStatistics statistics;
+    if (!handler.run(qMax(1, parser.value(durationOption).toInt()), &statistics)) {
+        QTextStream(stderr) << errorString << "\n";
+        return 1;
+    }
+
+    QJsonObject classes;
+    for (QMap<QString, int>::const_iterator it = statistics.classCounts.constBegin(); it != statistics.classCounts.constEnd(); ++it) {
+        classes[it.key()] = it.value();
+    }
+
+    QJsonObject report = createReport();
+    report["input"] = inputFile;
+    report["seconds"] = statistics.seconds;
+    report["reductionCores"] = int(settings.reductionCoreCount);
+    report["timeCores"] = int(settings.timeCoreCount);
+    report["objectsBefore"] = statistics.objectsBefore;
+    report["objectsAfter"] = statistics.objectsAfter;
+
+    // Every reduction injects its productions, so this is the closest there is to reductions per second
+    report["newObjectsPerSecond"] = (statistics.objectsAfter - statistics.objectsBefore) / statistics.seconds;
+    report["perfSamples"] = statistics.perfSamples;
+    report["meanReductionLatencyUs"] = statistics.meanReductionLatency;
+    report["meanTimeLatencyUs"] = statistics.meanTimeLatency;
+    report["classes"] = classes;
+
+    if (parser.isSet(imageOutputOption) && !handler.writeCurrentImage(parser.value(imageOutputOption))) {
+        QTextStream(stderr) << "Unable to write image to " << parser.value(imageOutputOption) << "\n";
+        return 1;
+    }
+
+    return writeReport(report, parser.value(outputOption)) ? 0 : 1;
+}
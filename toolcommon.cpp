@@ -0,0 +1,45 @@
+#include "toolcommon.h"
+#include <QFile>
+#include <QThread>
+#include <QTextStream>
+#include <QJsonDocument>
+
+void useOffscreenPlatform()
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+}
+
+QStringList splitCommaList(const QString &list)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    return list.split(',', Qt::SkipEmptyParts);
+#else
+    return list.split(',', QString::SkipEmptyParts);
+#endif
+}
+
+QJsonObject createReport()
+{
+    QJsonObject report;
+    report["qtVersion"] = qVersion();
+    report["idealThreadCount"] = QThread::idealThreadCount();
+    return report;
+}
+
+bool writeReport(const QJsonObject &report, const QString &path)
+{
+    const QByteArray json = QJsonDocument(report).toJson();
+    if (path.isEmpty()) {
+        QTextStream(stdout) << json;
+        return true;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        QTextStream(stderr) << "Unable to open " << file.fileName() << " for writing\n";
+        return false;
+    }
+    return file.write(json) == json.size();
+}
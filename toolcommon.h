@@ -0,0 +1,38 @@
+#ifndef TOOLCOMMON_H
+#define TOOLCOMMON_H
+
+#include <QStringList>
+#include <QJsonObject>
+#include <QElapsedTimer>
+#include <limits>
+
+// Shared by the command line tools in benchmark/ and runner/
+
+// They never show anything, but the fonts and the highlighter need a GUI application.
+// Has to be called before the application is created, a platform set in the environment still wins.
+void useOffscreenPlatform();
+
+// Comma separated values from the command line, without the empty ones
+QStringList splitCommaList(const QString &list);
+
+// Starts a report with the Qt version and the number of hardware threads, so results can be compared across machines
+QJsonObject createReport();
+
+// Prints the report as JSON to stdout, or writes it to path if that isn't empty. False if it couldn't be written.
+bool writeReport(const QJsonObject &report, const QString &path);
+
+// Runs the function that many times and returns the fastest run in milliseconds, the others are noise
+template<typename Function>
+double bestOf(int runs, Function function)
+{
+    qint64 best = std::numeric_limits<qint64>::max();
+    for (int run = 0; run < runs; run++) {
+        QElapsedTimer timer;
+        timer.start();
+        function();
+        best = qMin(best, timer.nsecsElapsed());
+    }
+    return best / 1000000.;
+}
+
+#endif // TOOLCOMMON_H
@@ -0,0 +1,7 @@
+# Helpers shared by the command line tools
+
+INCLUDEPATH += $$PWD
+
+SOURCES += $$PWD/toolcommon.cpp
+
+HEADERS  += $$PWD/toolcommon.h
@@ -1,6 +1,7 @@
 #include "window.h"
 #include "hivewidget.h"
 #include "replicodehandler.h"
+#include "perfchart.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QPushButton>
@@ -10,18 +11,31 @@
 #include <QFile>
 #include <QTextEdit>
 #include <QListWidget>
+#include <QSpinBox>
+#include <QProgressBar>
+#include <QThread>
 #include <QDebug>
 
 Window::Window(QWidget *parent) : QWidget(parent),
+    m_debugStream(std::cout),
+    m_errorStream(std::cerr),
     m_hivePlot(new HiveWidget(this)),
     m_replicode(new ReplicodeHandler(this)),
     m_loadImageButton(new QPushButton("Load &image...", this)),
     m_loadSourceButton(new QPushButton("&Load source...", this)),
     m_runButton(new QPushButton("&Run", this)),
+    m_bundleButton(new QPushButton("&Bundle edges", this)),
+    m_timingsButton(new QPushButton("&Timings", this)),
+    m_progressiveButton(new QPushButton("&Progressive rendering", this)),
+    m_liveButton(new QPushButton("Li&ve updates", this)),
+    m_autoTuneButton(new QPushButton("&Auto-tune cores", this)),
+    m_liveIntervalBox(new QSpinBox(this)),
+    m_progressBar(new QProgressBar(this)),
     m_outputView(new QTextEdit),
-    m_debugStream(std::cout),
-    m_errorStream(std::cerr)
+    m_perfChart(new PerfChart(this))
 {
+    m_startupTimer.start();
+
     m_textColor = palette().color(QPalette::Active, QPalette::ButtonText);
     connect(&m_debugStream, &StreamRedirector::stringOutput, this, [=](QString string) {
             m_outputView->setTextColor(m_textColor);
@@ -43,6 +57,70 @@ Window::Window(QWidget *parent) : QWidget(parent),
     connect(m_loadSourceButton, &QPushButton::clicked, this, &Window::onLoadSource);
     connect(m_runButton, &QPushButton::clicked, this, &Window::onRunClicked);
 
+    m_bundleButton->setCheckable(true);
+    connect(m_bundleButton, &QPushButton::toggled, m_hivePlot, &HiveWidget::setBundleEdges);
+
+    m_progressiveButton->setCheckable(true);
+    connect(m_progressiveButton, &QPushButton::toggled, m_hivePlot, &HiveWidget::setProgressiveRendering);
+
+    QPushButton *saveTimingsButton = new QPushButton("Save timings...");
+    saveTimingsButton->setEnabled(false);
+    m_timingsButton->setCheckable(true);
+    connect(m_timingsButton, &QPushButton::toggled, m_hivePlot, &HiveWidget::setShowTimings);
+    connect(m_timingsButton, &QPushButton::toggled, saveTimingsButton, &QPushButton::setEnabled);
+    connect(saveTimingsButton, &QPushButton::clicked, this, &Window::onSaveTimings);
+
+    // Sampling rate of the running rmem
+    QSettings settings;
+    m_liveIntervalBox->setRange(50, 10000);
+    m_liveIntervalBox->setSingleStep(50);
+    m_liveIntervalBox->setSuffix(" ms");
+    m_liveIntervalBox->setValue(settings.value("liveinterval", 500).toInt());
+    m_liveButton->setCheckable(true);
+    connect(m_liveButton, &QPushButton::toggled, this, &Window::onLiveToggled);
+    connect(m_liveIntervalBox, QOverload<int>::of(&QSpinBox::valueChanged), this, [=](int interval) {
+            QSettings().setValue("liveinterval", interval);
+            if (m_liveButton->isChecked() && m_runButton->isChecked()) {
+                m_replicode->startSampling(interval);
+            }
+        });
+    connect(m_replicode, &ReplicodeHandler::graphChanged, m_hivePlot, &HiveWidget::applyDiff);
+    connect(m_hivePlot, &HiveWidget::resyncNeeded, m_replicode, &ReplicodeHandler::requestResync);
+
+    // Reduction and time job latencies while running. The rmem doesn't expose its job queues,
+    // so there's no queue depth to show.
+    QPushButton *savePerfButton = new QPushButton("Save perf...");
+    connect(m_replicode, &ReplicodeHandler::perfSample, m_perfChart, &PerfChart::addSample);
+    connect(savePerfButton, &QPushButton::clicked, this, &Window::onSavePerf);
+
+    // Otherwise the core counts come from the settings, used when the next source is loaded
+    m_autoTuneButton->setCheckable(true);
+    m_autoTuneButton->setChecked(settings.value("mem/autotune", false).toBool());
+    connect(m_autoTuneButton, &QPushButton::toggled, this, [=](bool checked) {
+            QSettings().setValue("mem/autotune", checked);
+        });
+
+    // Decompiling and laying out happen in the background, the progress bar is only shown while they run
+    m_progressBar->hide();
+    connect(m_replicode, &ReplicodeHandler::decompileProgress, this, [=](int done, int total) {
+            m_progressBar->setFormat("Decompiling %p%");
+            m_progressBar->setRange(0, total);
+            m_progressBar->setValue(done);
+            m_progressBar->show();
+        });
+    connect(m_replicode, &ReplicodeHandler::graphLoaded, this, &Window::loadNodes);
+    connect(m_replicode, &ReplicodeHandler::decompileCanceled, m_progressBar, &QProgressBar::hide);
+    connect(m_hivePlot, &HiveWidget::graphReady, m_progressBar, &QProgressBar::hide);
+    connect(m_hivePlot, &HiveWidget::graphCanceled, m_progressBar, &QProgressBar::hide);
+
+    // Nothing can be loaded until replicode has compiled the classes in the background
+    m_loadImageButton->setDisabled(true);
+    m_loadSourceButton->setDisabled(true);
+    m_progressBar->setFormat("Initializing...");
+    m_progressBar->setRange(0, 0);
+    m_progressBar->show();
+    connect(m_replicode, &ReplicodeHandler::initialized, this, &Window::onInitialized);
+
     QHBoxLayout *l = new QHBoxLayout;
     setLayout(l);
     l->addWidget(m_hivePlot, 3);
@@ -53,12 +131,46 @@ Window::Window(QWidget *parent) : QWidget(parent),
     rightLayout->addWidget(m_runButton);
     rightLayout->addWidget(m_outputView);
     rightLayout->addWidget(clearButton);
+    rightLayout->addWidget(m_perfChart);
+    rightLayout->addWidget(savePerfButton);
+    rightLayout->addWidget(m_bundleButton);
+    rightLayout->addWidget(m_progressiveButton);
+    QHBoxLayout *timingsLayout = new QHBoxLayout;
+    timingsLayout->addWidget(m_timingsButton);
+    timingsLayout->addWidget(saveTimingsButton);
+    rightLayout->addLayout(timingsLayout);
+    QHBoxLayout *liveLayout = new QHBoxLayout;
+    liveLayout->addWidget(m_liveButton);
+    liveLayout->addWidget(m_liveIntervalBox);
+    rightLayout->addLayout(liveLayout);
     rightLayout->addSpacing(m_runButton->height());
+    rightLayout->addWidget(m_autoTuneButton);
     rightLayout->addWidget(m_loadSourceButton);
     rightLayout->addWidget(m_loadImageButton);
+    rightLayout->addWidget(m_progressBar);
     l->addLayout(rightLayout, 1);
 
     layout()->setContentsMargins(0, 0, 0, 0);
+
+    qDebug() << "Window created in" << m_startupTimer.elapsed() << "ms";
+}
+
+Window::~Window()
+{
+    // Stops everything that might still write to std::cout and std::cerr before the redirectors restore them
+    delete m_replicode;
+}
+
+void Window::onInitialized(bool success)
+{
+    m_progressBar->hide();
+    if (!success) {
+        return;
+    }
+
+    qDebug() << "Ready to load after" << m_startupTimer.elapsed() << "ms";
+    m_loadImageButton->setEnabled(true);
+    m_loadSourceButton->setEnabled(true);
 }
 
 void Window::onLoadImage()
@@ -73,7 +185,6 @@ void Window::onLoadImage()
     settings.setValue("lastimage", filePath);
 
     m_replicode->loadImage(filePath);
-    loadNodes();
 
     m_loadImageButton->setDisabled(true);
     m_loadSourceButton->setDisabled(true);
@@ -88,8 +199,13 @@ void Window::onLoadSource()
         return;
     }
     settings.setValue("lastfile", filePath);
+
+    MemSettings memSettings = MemSettings::load();
+    if (m_autoTuneButton->isChecked()) {
+        memSettings.autoTune(QThread::idealThreadCount());
+    }
+    m_replicode->setMemSettings(memSettings);
     m_replicode->loadSource(filePath);
-    loadNodes();
 
     m_loadImageButton->setDisabled(true);
     m_loadSourceButton->setDisabled(true);
@@ -99,27 +215,70 @@ void Window::onRunClicked(bool checked)
 {
     if (checked) {
         qDebug() << "Starting...";
+        m_perfChart->clear();
         if (!m_replicode->start()) {
             m_runButton->setChecked(false);
+            return;
         }
         m_runButton->setText("&Stop");
+        if (m_liveButton->isChecked()) {
+            m_replicode->startSampling(m_liveIntervalBox->value());
+        }
     } else {
         qDebug() << "Stopping...";
         m_replicode->stop();
-        loadNodes();
         m_runButton->setText("&Run");
     }
 }
 
+void Window::onLiveToggled(bool checked)
+{
+    // Only samples while running, stop() updates the plot anyway
+    if (checked && m_runButton->isChecked()) {
+        m_replicode->startSampling(m_liveIntervalBox->value());
+    } else {
+        m_replicode->stopSampling();
+    }
+}
+
 void Window::onReplicodeError(QString error)
 {
     QMessageBox::warning(this, "Replicode error", error);
 }
 
-void Window::loadNodes()
+void Window::onSaveTimings()
 {
-    const QMap<QString, Node> nodes = m_replicode->getNodes();
+    QString filePath = QFileDialog::getSaveFileName(this, "Save timings", "timings.csv", "*.csv");
+    if (filePath.isEmpty()) {
+        return;
+    }
 
-    m_hivePlot->setNodes(nodes);
-    m_hivePlot->setEdges(m_replicode->getEdges());
+    if (!m_hivePlot->saveTimings(filePath)) {
+        QMessageBox::warning(this, "Unable to save timings", "Failed to write timings to " + filePath);
+    }
+}
+
+void Window::onSavePerf()
+{
+    QString filePath = QFileDialog::getSaveFileName(this, "Save perf samples", "perf.csv", "*.csv");
+    if (filePath.isEmpty()) {
+        return;
+    }
+
+    if (!m_perfChart->save(filePath)) {
+        QMessageBox::warning(this, "Unable to save perf samples", "Failed to write perf samples to " + filePath);
+    }
+}
+
+void Window::loadNodes()
+{
+    // No percentage for the layout, it runs in parallel over the edges
+    m_progressBar->setFormat("Laying out...");
+    m_progressBar->setRange(0, 0);
+    m_progressBar->show();
+    // The handler may have decompiled something else by the time the layout is done, so the widget gets its own copy of the sources
+    const QVector<QByteArray> sources = m_replicode->getSources();
+    m_hivePlot->setGraph(m_replicode->getNodes(), m_replicode->getEdges(), [=](int objectIndex) {
+            return ReplicodeHandler::createSourceDocument(sources, objectIndex);
+        });
 }
@@ -2,6 +2,7 @@
 #define WINDOW_H
 
 #include <QWidget>
+#include <QElapsedTimer>
 #include "streamredirector.h"
 
 class HiveWidget;
@@ -10,12 +11,16 @@ class QPushButton;
 class QTextEdit;
 class QListWidget;
 class QListWidgetItem;
+class QSpinBox;
+class QProgressBar;
+class PerfChart;
 
 class Window : public QWidget
 {
     Q_OBJECT
 public:
     explicit Window(QWidget *parent = 0);
+    ~Window();
 
 signals:
 
@@ -24,19 +29,37 @@ private slots:
     void onLoadSource();
     void onRunClicked(bool checked);
     void onReplicodeError(QString error);
+    void onSaveTimings();
+    void onSavePerf();
+    void onLiveToggled(bool checked);
+    void onInitialized(bool success);
 
 private:
     void loadNodes();
 
+    // Declared first, so std::cout and std::cerr are redirected before replicode starts initializing
+    // in the background and writing to them
+    StreamRedirector m_debugStream;
+    StreamRedirector m_errorStream;
+
     HiveWidget *m_hivePlot;
     ReplicodeHandler *m_replicode;
     QPushButton *m_loadImageButton;
     QPushButton *m_loadSourceButton;
     QPushButton *m_runButton;
+    QPushButton *m_bundleButton;
+    QPushButton *m_timingsButton;
+    QPushButton *m_progressiveButton;
+    QPushButton *m_liveButton;
+    QPushButton *m_autoTuneButton;
+    QSpinBox *m_liveIntervalBox;
+    QProgressBar *m_progressBar;
     QTextEdit *m_outputView;
-    StreamRedirector m_debugStream;
-    StreamRedirector m_errorStream;
+    PerfChart *m_perfChart;
     QColor m_textColor;
+
+    // Since the window was created, for the startup timings
+    QElapsedTimer m_startupTimer;
 };
 
 #endif // WINDOW_H